@@ -0,0 +1,45 @@
+#include "allocation_counter.hpp"
+#include <cstdlib>
+#include <new>
+
+using namespace wordalyzer;
+
+#ifndef NDEBUG
+namespace wordalyzer {
+    thread_local size_t thread_allocation_count = 0;
+}
+
+// The array and nothrow forms of the standard operators forward to these,
+// so replacing them is enough to see every allocation.
+void* operator new(size_t size)
+{
+    thread_allocation_count++;
+
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+size_t wordalyzer::get_thread_allocation_count()
+{
+    return thread_allocation_count;
+}
+#else
+size_t wordalyzer::get_thread_allocation_count()
+{
+    return 0;
+}
+#endif
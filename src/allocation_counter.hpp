@@ -0,0 +1,9 @@
+#pragma once
+#include <cstddef>
+
+namespace wordalyzer {
+    // Returns the number of heap allocations made so far by the calling
+    // thread. Allocations are only counted in debug builds; with NDEBUG
+    // defined this always returns 0.
+    size_t get_thread_allocation_count();
+}
@@ -1,54 +1,273 @@
 #include "audio.hpp"
-#include <cassert>
+#include <cstring>
+#include <algorithm>
 
 using namespace wordalyzer;
 using namespace std;
 
-vector<byte> wordalyzer::serialize_word(const word_t& word)
+namespace wordalyzer {
+    const byte WORD_MAGIC[4] = { 'W', 'R', 'D', 'Z' };
+
+    // Types of the coefficients of a serialized word
+    const byte WORD_DTYPE_F64_LE = 1;
+    const byte WORD_DTYPE_F32_LE = 2;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    const bool HOST_BIG_ENDIAN = true;
+#else
+    const bool HOST_BIG_ENDIAN = false;
+#endif
+
+    template<typename T>
+    void swap_value_bytes(T* values, size_t count);
+
+    template<typename T>
+    void serialize_coeffs(const frame_matrix<T>& coeffs, byte dtype, vector<byte>& res);
+    template<typename T>
+    void deserialize_coeffs(const word_layout_t& layout, const byte* data, frame_matrix<T>& coeffs);
+    template<typename T>
+    frame_matrix_view<T> view_coeffs(const word_layout_t& layout, const byte* data, vector<T>& buffer);
+    template<typename T>
+    void copy_coeffs(const frame_matrix_view<T>& view, frame_matrix<T>& coeffs);
+}
+
+template<typename T>
+void wordalyzer::swap_value_bytes(T* values, size_t count)
 {
-    vector<byte> res;
-    serialize_size(word.coeff_vectors.size(), res);
-    if (!word.coeff_vectors.empty()) {
-        serialize_size(word.coeff_vectors[0].size(), res);
-        for (const auto& v : word.coeff_vectors) {
-            assert(v.size() == word.coeff_vectors[0].size() && "Mismatching sizes for coefficient vectors");
-            for (double d : v) {
-                serialize_double(d, res);
+    byte* bytes = reinterpret_cast<byte*>(values);
+    for (size_t i = 0; i < count; i++) {
+        reverse(bytes + i * sizeof(T), bytes + (i + 1) * sizeof(T));
+    }
+}
+
+word_layout_t wordalyzer::read_word_layout(const byte* data, size_t size)
+{
+    word_layout_t layout;
+
+    if (size >= sizeof(WORD_MAGIC) && memcmp(data, WORD_MAGIC, sizeof(WORD_MAGIC)) == 0) {
+        if (size < WORD_HEADER_SIZE) {
+            throw format_exception("Word data too short for its header");
+        }
+
+        if (data[4] != WORD_FORMAT_VERSION) {
+            throw format_exception("Unsupported word format version " + to_string(data[4]));
+        }
+
+        switch (data[5]) {
+        case WORD_DTYPE_F64_LE: layout.precision = PRECISION_DOUBLE; break;
+        case WORD_DTYPE_F32_LE: layout.precision = PRECISION_SINGLE; break;
+        default: throw format_exception("Unsupported word coefficient type " + to_string(data[5]));
+        }
+
+        layout.frames = load_le(data + 8, 8);
+        layout.order = load_le(data + 16, 8);
+        layout.payload_offset = WORD_HEADER_SIZE;
+        layout.swapped = HOST_BIG_ENDIAN;
+    } else {
+        // The format without a header
+        if (size < 8) {
+            throw format_exception("Word data too short for its header");
+        }
+
+        layout.frames = load_le(data, 8);
+        layout.order = 0;
+        layout.precision = PRECISION_DOUBLE;
+        layout.payload_offset = 8;
+        layout.swapped = false;
+
+        if (layout.frames > 0) {
+            if (size < 16) {
+                throw format_exception("Word data too short for its header");
             }
+
+            layout.order = load_le(data + 8, 8);
+            layout.payload_offset = 16;
+        }
+    }
+
+    // The coefficients must fill the rest of the data exactly
+    size_t payload_size = size - layout.payload_offset;
+    size_t max_values = payload_size / get_coeff_size(layout);
+    if (layout.frames > 0 && layout.order > 0) {
+        if (layout.order > max_values || layout.frames > max_values / layout.order) {
+            throw format_exception("Word data too short for " + to_string(layout.frames) + " frames of order "
+                                   + to_string(layout.order));
         }
+        payload_size -= layout.frames * layout.order * get_coeff_size(layout);
+    }
+
+    if (payload_size != 0) {
+        throw format_exception("Word data has " + to_string(payload_size) + " unexpected trailing bytes");
+    }
+
+    return layout;
+}
+
+size_t wordalyzer::get_coeff_size(const word_layout_t& layout)
+{
+    return layout.precision == PRECISION_SINGLE ? sizeof(float) : sizeof(double);
+}
+
+void wordalyzer::fix_coeff_byte_order(const word_layout_t& layout, double* coeffs, size_t count)
+{
+    if (layout.swapped) {
+        swap_value_bytes(coeffs, count);
+    }
+}
+
+void wordalyzer::fix_coeff_byte_order(const word_layout_t& layout, float* coeffs, size_t count)
+{
+    if (layout.swapped) {
+        swap_value_bytes(coeffs, count);
+    }
+}
+
+template<typename T>
+void wordalyzer::serialize_coeffs(const frame_matrix<T>& coeffs, byte dtype, vector<byte>& res)
+{
+    size_t frames = coeffs.get_frames();
+    size_t order = coeffs.get_order();
+    size_t row_bytes = order * sizeof(T);
+
+    res.resize(WORD_HEADER_SIZE + frames * row_bytes);
+    memcpy(&res[0], WORD_MAGIC, sizeof(WORD_MAGIC));
+    res[4] = WORD_FORMAT_VERSION;
+    res[5] = dtype;
+    store_le(frames, 8, &res[8]);
+    store_le(order, 8, &res[16]);
+
+    if (frames > 0 && row_bytes > 0) {
+        byte* payload = &res[WORD_HEADER_SIZE];
+        if (coeffs.is_contiguous()) {
+            memcpy(payload, coeffs.data(), frames * row_bytes);
+        } else {
+            for (size_t i = 0; i < frames; i++) {
+                memcpy(payload + i * row_bytes, coeffs.row(i).data(), row_bytes);
+            }
+        }
+
+        if (HOST_BIG_ENDIAN) {
+            swap_value_bytes(reinterpret_cast<T*>(payload), frames * order);
+        }
+    }
+}
+
+vector<byte> wordalyzer::serialize_word(const word_t& word)
+{
+    vector<byte> res;
+    if (word.precision == PRECISION_SINGLE) {
+        serialize_coeffs(word.single_coeffs, WORD_DTYPE_F32_LE, res);
+    } else {
+        serialize_coeffs(word.coeffs, WORD_DTYPE_F64_LE, res);
     }
 
     return res;
 }
 
-word_t wordalyzer::deserialize_word(const vector<byte>& bytes)
+template<typename T>
+void wordalyzer::deserialize_coeffs(const word_layout_t& layout, const byte* data, frame_matrix<T>& coeffs)
+{
+    // Words without frames keep their order too, so that they round-trip
+    size_t count = layout.frames * layout.order;
+    coeffs.resize(layout.frames, layout.order);
+    if (count > 0) {
+        memcpy(coeffs.data(), data + layout.payload_offset, count * sizeof(T));
+        fix_coeff_byte_order(layout, coeffs.data(), count);
+    }
+}
+
+word_t wordalyzer::deserialize_word(const byte* data, size_t size)
 {
+    word_layout_t layout = read_word_layout(data, size);
+
     word_t res;
-    auto it = bytes.begin();
-    size_t remaining_bytes = bytes.size();
+    res.precision = layout.precision;
+    if (layout.precision == PRECISION_SINGLE) {
+        deserialize_coeffs(layout, data, res.single_coeffs);
+    } else {
+        deserialize_coeffs(layout, data, res.coeffs);
+    }
 
-    assert(remaining_bytes >= sizeof(size_t) && "Not enough bytes");
-    size_t count = deserialize_size(it);
-    remaining_bytes -= sizeof(size_t);
+    return res;
+}
 
+word_t wordalyzer::deserialize_word(const vector<byte>& bytes)
+{
+    return deserialize_word(bytes.data(), bytes.size());
+}
+
+template<typename T>
+frame_matrix_view<T> wordalyzer::view_coeffs(const word_layout_t& layout, const byte* data, vector<T>& buffer)
+{
+    size_t count = layout.frames * layout.order;
+    const byte* payload = data + layout.payload_offset;
+
+    if (count == 0) {
+        return frame_matrix_view<T>(nullptr, layout.frames, layout.order);
+    }
+
+    if (!layout.swapped && reinterpret_cast<uintptr_t>(payload) % alignof(T) == 0) {
+        return frame_matrix_view<T>(reinterpret_cast<const T*>(payload), layout.frames, layout.order);
+    }
+
+    if (buffer.size() < count) {
+        buffer.resize(count);
+    }
+
+    memcpy(buffer.data(), payload, count * sizeof(T));
+    fix_coeff_byte_order(layout, buffer.data(), count);
+    return frame_matrix_view<T>(buffer.data(), layout.frames, layout.order);
+}
+
+word_view_t wordalyzer::view_word(const byte* data, size_t size, word_buffer_t& buffer)
+{
+    word_layout_t layout = read_word_layout(data, size);
+
+    word_view_t res;
+    res.precision = layout.precision;
+    if (layout.precision == PRECISION_SINGLE) {
+        res.single_coeffs = view_coeffs(layout, data, buffer.single_coeffs);
+    } else {
+        res.coeffs = view_coeffs(layout, data, buffer.coeffs);
+    }
+
+    return res;
+}
+
+template<typename T>
+void wordalyzer::copy_coeffs(const frame_matrix_view<T>& view, frame_matrix<T>& coeffs)
+{
+    size_t count = view.get_frames() * view.get_order();
+    coeffs.resize(view.get_frames(), view.get_order());
     if (count > 0) {
-        assert(remaining_bytes >= sizeof(size_t) && "Not enough bytes");
-        size_t v_size = deserialize_size(it);
-        remaining_bytes -= sizeof(size_t);
-
-        if (v_size > 0) {
-            assert(remaining_bytes >= count * v_size * sizeof(double) && "Not enough bytes");
-
-            res.coeff_vectors.resize(count);
-            for (size_t i = 0; i < count; i++) {
-                res.coeff_vectors[i].resize(v_size);
-                for (size_t j = 0; j < v_size; j++) {
-                    res.coeff_vectors[i][j] = deserialize_double(it);
-                }
-            }
-        } else {
-            res.coeff_vectors.resize(count);
-        }
+        memcpy(coeffs.data(), view.data(), count * sizeof(T));
+    }
+}
+
+word_t wordalyzer::copy_word(const word_view_t& view)
+{
+    word_t res;
+    res.precision = view.precision;
+    if (view.precision == PRECISION_SINGLE) {
+        copy_coeffs(view.single_coeffs, res.single_coeffs);
+    } else {
+        copy_coeffs(view.coeffs, res.coeffs);
+    }
+
+    return res;
+}
+
+word_t wordalyzer::widen_word(word_t word)
+{
+    if (word.precision != PRECISION_SINGLE) {
+        return word;
+    }
+
+    const frame_matrix<float>& single_coeffs = word.single_coeffs;
+    word_t res;
+    res.coeffs.resize(single_coeffs.get_frames(), single_coeffs.get_order());
+    for (size_t i = 0; i < single_coeffs.get_frames(); i++) {
+        copy(single_coeffs.row(i).begin(), single_coeffs.row(i).end(), res.coeffs.row(i).begin());
     }
 
     return res;
@@ -3,13 +3,62 @@
 #include <vector>
 
 #include "common.hpp"
+#include "frame_matrix.hpp"
 #include <exception>
 
 namespace wordalyzer {
     struct clip_t;
 
+    // Precision a clip's coefficients are stored in. Analysis always runs
+    // in double, single precision only rounds the finished coefficients.
+    enum Precision {
+        PRECISION_DOUBLE,
+        PRECISION_SINGLE
+    };
+
+    // The coefficients of a word are kept in `coeffs` or `single_coeffs`,
+    // depending on its precision. The other matrix is empty.
     struct word_t {
-        std::vector<std::vector<double>> coeff_vectors;
+        Precision precision;
+        frame_matrix<double> coeffs;
+        frame_matrix<float> single_coeffs;
+
+        word_t() : precision(PRECISION_DOUBLE) {}
+
+        size_t get_frames() const
+        {
+            return precision == PRECISION_SINGLE ? single_coeffs.get_frames() : coeffs.get_frames();
+        }
+
+        size_t get_order() const
+        {
+            return precision == PRECISION_SINGLE ? single_coeffs.get_order() : coeffs.get_order();
+        }
+    };
+
+    // The coefficients of a word, stored elsewhere
+    struct word_view_t {
+        Precision precision;
+        frame_matrix_view<double> coeffs;
+        frame_matrix_view<float> single_coeffs;
+
+        word_view_t() : precision(PRECISION_DOUBLE) {}
+
+        size_t get_frames() const
+        {
+            return precision == PRECISION_SINGLE ? single_coeffs.get_frames() : coeffs.get_frames();
+        }
+
+        size_t get_order() const
+        {
+            return precision == PRECISION_SINGLE ? single_coeffs.get_order() : coeffs.get_order();
+        }
+    };
+
+    // Copies of coefficients that can't be viewed where they are stored
+    struct word_buffer_t {
+        std::vector<double> coeffs;
+        std::vector<float> single_coeffs;
     };
 
     struct clip_t {
@@ -19,6 +68,10 @@ namespace wordalyzer {
         int vector_size;
         int window_size;
         int window_stride;
+        Precision precision;
+
+        // The rate the clip was analyzed at, 0 if it is not known
+        int sample_rate;
     };
 
     struct audio_t {
@@ -46,6 +99,62 @@ namespace wordalyzer {
         }
     };
 
+    // A serialized word starts with a header of WORD_HEADER_SIZE bytes: the
+    // magic "WRDZ", the format version, the type of the coefficients, two
+    // reserved zero bytes, then the frame count and the order as
+    // little-endian 64-bit integers. The coefficients follow frame by frame
+    // as little-endian doubles or floats, as given by the type, aligned to
+    // their size within the data.
+    //
+    // Words serialized before the header existed start with the frame
+    // count as a 64-bit integer, followed by the order and native-endian
+    // coefficients only if there are any frames. Such a count can't start
+    // with the magic without the word taking gigabytes.
+    const size_t WORD_HEADER_SIZE = 24;
+    const byte WORD_FORMAT_VERSION = 1;
+
+    // Where the coefficients of a serialized word are
+    struct word_layout_t {
+        size_t frames;
+        size_t order;
+        Precision precision;
+
+        // Offset of the first coefficient from the start of the data
+        size_t payload_offset;
+
+        // True if the coefficients are not in the host's byte order
+        bool swapped;
+    };
+
+    // Reads the layout of a serialized word of `size` bytes, from its
+    // first min(size, WORD_HEADER_SIZE) bytes at `data`. Throws
+    // format_exception if the header is not valid or does not match
+    // `size`.
+    word_layout_t read_word_layout(const byte* data, size_t size);
+
+    // Size in bytes of one coefficient of a word with `layout`
+    size_t get_coeff_size(const word_layout_t& layout);
+
+    // Puts `count` coefficients copied from a word with `layout` in the
+    // host's byte order
+    void fix_coeff_byte_order(const word_layout_t& layout, double* coeffs, size_t count);
+    void fix_coeff_byte_order(const word_layout_t& layout, float* coeffs, size_t count);
+
     std::vector<byte> serialize_word(const word_t& word);
+    word_t deserialize_word(const byte* data, size_t size);
     word_t deserialize_word(const std::vector<byte>& bytes);
+
+    // Views the coefficients of a serialized word where they are, if they
+    // are aligned and in the host's byte order, and otherwise copies them
+    // to `buffer`. The buffer only allocates when a word is larger than
+    // the ones before, so scanning many words with the same buffer does
+    // not allocate per word. The view is valid as long as the data and
+    // the buffer are unchanged.
+    word_view_t view_word(const byte* data, size_t size, word_buffer_t& buffer);
+
+    word_t copy_word(const word_view_t& view);
+
+    // Returns `word` with its coefficients in double precision, for code
+    // that compares words of either precision
+    word_t widen_word(word_t word);
 }
@@ -0,0 +1,444 @@
+#include "autocorrelation.hpp"
+#include "fft.hpp"
+#include "simd.hpp"
+#include <cmath>
+
+using namespace wordalyzer;
+using namespace std;
+
+namespace wordalyzer {
+    typedef void (*autocorrelation_kernel)(const double* x, size_t n, int lags, double* R);
+    typedef void (*autocorrelation_group_kernel)(const double* x, size_t n, int lag0, double* R);
+
+    void autocorrelate_scalar(const double* x, size_t n, int lags, double* R);
+    autocorrelation_kernel get_autocorrelation_kernel();
+
+    template<int Lags>
+    void autocorrelate_group_scalar(const double* x, size_t n, int lag0, double* R);
+    template<int Lags>
+    autocorrelation_group_kernel get_fixed_autocorrelation_kernel();
+
+    double* load_padded_samples(const float* samples, size_t n, int lags, autocorrelation_scratch_t& scratch);
+
+    typedef double (*dot_product_kernel)(const float* a, const float* b, size_t n);
+    double dot_product_scalar(const float* a, const float* b, size_t n);
+    dot_product_kernel get_dot_product_kernel();
+
+    int get_direct_lags(int p);
+    size_t get_fft_size(size_t n, int p);
+
+#ifdef WORDALYZER_X86
+    // Lags are processed in groups of up to MAX_BLOCKS vector registers, so
+    // that every accumulator of a group stays in a register while the
+    // samples are streamed through once per group.
+    const int MAX_BLOCKS = 8;
+
+    template<int Blocks>
+    WORDALYZER_TARGET_SSE2 void autocorrelate_group_sse2(const double* x, size_t n, int lag0, double* R);
+    WORDALYZER_TARGET_SSE2 void autocorrelate_sse2(const double* x, size_t n, int lags, double* R);
+
+    template<int Blocks>
+    WORDALYZER_TARGET_AVX2 void autocorrelate_group_avx2(const double* x, size_t n, int lag0, double* R);
+    WORDALYZER_TARGET_AVX2 void autocorrelate_avx2(const double* x, size_t n, int lags, double* R);
+
+    template<int Blocks>
+    WORDALYZER_TARGET_AVX2 void autocorrelate_pairs_avx2(const double* x, size_t n, int lag0, double* R);
+
+    WORDALYZER_TARGET_AVX2 double dot_product_avx2(const float* a, const float* b, size_t n);
+#endif
+}
+
+// All kernels expect `x` to be followed by enough zeros to read a whole
+// vector past the last lag, so no lag needs a tail loop.
+void wordalyzer::autocorrelate_scalar(const double* x, size_t n, int lags, double* R)
+{
+    for (int k = 0; k < lags; k++) {
+        double res = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            res += x[i] * x[i + k];
+        }
+        R[k] = res;
+    }
+}
+
+template<int Lags>
+void wordalyzer::autocorrelate_group_scalar(const double* x, size_t n, int lag0, double* R)
+{
+    double acc[Lags] = {};
+    for (size_t i = 0; i < n; i++) {
+        const double* lagged = x + i + lag0;
+        for (int k = 0; k < Lags; k++) {
+            acc[k] += x[i] * lagged[k];
+        }
+    }
+
+    for (int k = 0; k < Lags; k++) {
+        R[lag0 + k] = acc[k];
+    }
+}
+
+double wordalyzer::dot_product_scalar(const float* a, const float* b, size_t n)
+{
+    double res = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        res += static_cast<double>(a[i]) * static_cast<double>(b[i]);
+    }
+
+    return res;
+}
+
+#ifdef WORDALYZER_X86
+WORDALYZER_TARGET_AVX2
+double wordalyzer::dot_product_avx2(const float* a, const float* b, size_t n)
+{
+    // Two independent accumulators hide the multiply-add latency
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d a0 = _mm256_cvtps_pd(_mm_loadu_ps(a + i));
+        __m256d b0 = _mm256_cvtps_pd(_mm_loadu_ps(b + i));
+        __m256d a1 = _mm256_cvtps_pd(_mm_loadu_ps(a + i + 4));
+        __m256d b1 = _mm256_cvtps_pd(_mm_loadu_ps(b + i + 4));
+        acc0 = _mm256_fmadd_pd(a0, b0, acc0);
+        acc1 = _mm256_fmadd_pd(a1, b1, acc1);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    double res = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    return res + dot_product_scalar(a + i, b + i, n - i);
+}
+
+template<int Blocks>
+WORDALYZER_TARGET_SSE2
+void wordalyzer::autocorrelate_group_sse2(const double* x, size_t n, int lag0, double* R)
+{
+    __m128d acc[Blocks];
+    for (int b = 0; b < Blocks; b++) {
+        acc[b] = _mm_setzero_pd();
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        __m128d xi = _mm_set1_pd(x[i]);
+        const double* lagged = x + i + lag0;
+        for (int b = 0; b < Blocks; b++) {
+            acc[b] = _mm_add_pd(acc[b], _mm_mul_pd(xi, _mm_loadu_pd(lagged + 2 * b)));
+        }
+    }
+
+    for (int b = 0; b < Blocks; b++) {
+        _mm_storeu_pd(R + lag0 + 2 * b, acc[b]);
+    }
+}
+
+WORDALYZER_TARGET_SSE2
+void wordalyzer::autocorrelate_sse2(const double* x, size_t n, int lags, double* R)
+{
+    for (int lag0 = 0; lag0 < lags; lag0 += 2 * MAX_BLOCKS) {
+        switch ((min(lags - lag0, 2 * MAX_BLOCKS) + 1) / 2) {
+        case 1: autocorrelate_group_sse2<1>(x, n, lag0, R); break;
+        case 2: autocorrelate_group_sse2<2>(x, n, lag0, R); break;
+        case 3: autocorrelate_group_sse2<3>(x, n, lag0, R); break;
+        case 4: autocorrelate_group_sse2<4>(x, n, lag0, R); break;
+        case 5: autocorrelate_group_sse2<5>(x, n, lag0, R); break;
+        case 6: autocorrelate_group_sse2<6>(x, n, lag0, R); break;
+        case 7: autocorrelate_group_sse2<7>(x, n, lag0, R); break;
+        default: autocorrelate_group_sse2<MAX_BLOCKS>(x, n, lag0, R); break;
+        }
+    }
+}
+
+template<int Blocks>
+WORDALYZER_TARGET_AVX2
+void wordalyzer::autocorrelate_group_avx2(const double* x, size_t n, int lag0, double* R)
+{
+    __m256d acc[Blocks];
+    for (int b = 0; b < Blocks; b++) {
+        acc[b] = _mm256_setzero_pd();
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        __m256d xi = _mm256_broadcast_sd(x + i);
+        const double* lagged = x + i + lag0;
+        for (int b = 0; b < Blocks; b++) {
+            acc[b] = _mm256_fmadd_pd(xi, _mm256_loadu_pd(lagged + 4 * b), acc[b]);
+        }
+    }
+
+    for (int b = 0; b < Blocks; b++) {
+        _mm256_storeu_pd(R + lag0 + 4 * b, acc[b]);
+    }
+}
+
+// Like autocorrelate_group_avx2, but with two samples in flight and a
+// separate set of accumulators for each, which hides the latency of the
+// multiply-add chains. Needs twice the registers, so it is only used where
+// the number of blocks is known at compile time to be small enough.
+template<int Blocks>
+WORDALYZER_TARGET_AVX2
+void wordalyzer::autocorrelate_pairs_avx2(const double* x, size_t n, int lag0, double* R)
+{
+    static_assert(2 * Blocks + 2 <= 16, "Not enough registers for two sets of accumulators");
+
+    __m256d acc_even[Blocks], acc_odd[Blocks];
+    for (int b = 0; b < Blocks; b++) {
+        acc_even[b] = _mm256_setzero_pd();
+        acc_odd[b] = _mm256_setzero_pd();
+    }
+
+    size_t i = 0;
+    for (; i + 1 < n; i += 2) {
+        __m256d xi = _mm256_broadcast_sd(x + i);
+        __m256d xj = _mm256_broadcast_sd(x + i + 1);
+        const double* lagged = x + i + lag0;
+        for (int b = 0; b < Blocks; b++) {
+            acc_even[b] = _mm256_fmadd_pd(xi, _mm256_loadu_pd(lagged + 4 * b), acc_even[b]);
+            acc_odd[b] = _mm256_fmadd_pd(xj, _mm256_loadu_pd(lagged + 4 * b + 1), acc_odd[b]);
+        }
+    }
+
+    if (i < n) {
+        __m256d xi = _mm256_broadcast_sd(x + i);
+        const double* lagged = x + i + lag0;
+        for (int b = 0; b < Blocks; b++) {
+            acc_even[b] = _mm256_fmadd_pd(xi, _mm256_loadu_pd(lagged + 4 * b), acc_even[b]);
+        }
+    }
+
+    for (int b = 0; b < Blocks; b++) {
+        _mm256_storeu_pd(R + lag0 + 4 * b, _mm256_add_pd(acc_even[b], acc_odd[b]));
+    }
+}
+
+WORDALYZER_TARGET_AVX2
+void wordalyzer::autocorrelate_avx2(const double* x, size_t n, int lags, double* R)
+{
+    for (int lag0 = 0; lag0 < lags; lag0 += 4 * MAX_BLOCKS) {
+        switch ((min(lags - lag0, 4 * MAX_BLOCKS) + 3) / 4) {
+        case 1: autocorrelate_group_avx2<1>(x, n, lag0, R); break;
+        case 2: autocorrelate_group_avx2<2>(x, n, lag0, R); break;
+        case 3: autocorrelate_group_avx2<3>(x, n, lag0, R); break;
+        case 4: autocorrelate_group_avx2<4>(x, n, lag0, R); break;
+        case 5: autocorrelate_group_avx2<5>(x, n, lag0, R); break;
+        case 6: autocorrelate_group_avx2<6>(x, n, lag0, R); break;
+        case 7: autocorrelate_group_avx2<7>(x, n, lag0, R); break;
+        default: autocorrelate_group_avx2<MAX_BLOCKS>(x, n, lag0, R); break;
+        }
+    }
+}
+#endif
+
+dot_product_kernel wordalyzer::get_dot_product_kernel()
+{
+#ifdef WORDALYZER_X86
+    if (cpu_has_avx2()) {
+        return dot_product_avx2;
+    }
+#endif
+
+    return dot_product_scalar;
+}
+
+autocorrelation_kernel wordalyzer::get_autocorrelation_kernel()
+{
+#ifdef WORDALYZER_X86
+    if (cpu_has_avx2()) {
+        return autocorrelate_avx2;
+    }
+
+    if (cpu_has_sse2()) {
+        return autocorrelate_sse2;
+    }
+#endif
+
+    return autocorrelate_scalar;
+}
+
+int wordalyzer::get_direct_lags(int p)
+{
+    // The vector kernels write whole registers, so both the lag count and
+    // the zero padding after the samples are rounded up to a full vector.
+    const int VECTOR_LAGS = 4;
+    return (p + 1 + VECTOR_LAGS - 1) / VECTOR_LAGS * VECTOR_LAGS;
+}
+
+size_t wordalyzer::get_fft_size(size_t n, int p)
+{
+    // Padding to at least n + p keeps the circular correlation from
+    // wrapping around into the lags we are interested in.
+    return next_power_of_two(max<size_t>(n + p, 2));
+}
+
+// Picks the single-group kernel that covers all Lags at once, so that a
+// fixed order never needs more than one pass over the samples.
+template<int Lags>
+autocorrelation_group_kernel wordalyzer::get_fixed_autocorrelation_kernel()
+{
+#ifdef WORDALYZER_X86
+    static_assert(Lags % 4 == 0 && Lags / 4 <= MAX_BLOCKS, "Too many lags for a single AVX2 group");
+
+    // With too many blocks the second set of accumulators spills out of
+    // the registers and the pairwise kernel loses its advantage.
+    const int MAX_PAIR_BLOCKS = 5;
+    if (cpu_has_avx2()) {
+        if (Lags / 4 <= MAX_PAIR_BLOCKS) {
+            return autocorrelate_pairs_avx2<Lags / 4>;
+        }
+        return autocorrelate_group_avx2<Lags / 4>;
+    }
+
+    if (cpu_has_sse2()) {
+        return autocorrelate_group_sse2<Lags / 2>;
+    }
+#endif
+
+    return autocorrelate_group_scalar<Lags>;
+}
+
+double* wordalyzer::load_padded_samples(const float* samples, size_t n, int lags, autocorrelation_scratch_t& scratch)
+{
+    // Room for the samples, their zero padding and the kernel's results
+    size_t needed = n + lags + lags;
+    if (scratch.samples.size() < needed) {
+        scratch.samples.resize(needed);
+    }
+
+    double* x = &scratch.samples[0];
+    for (size_t i = 0; i < n; i++) {
+        x[i] = samples[i];
+    }
+    for (int i = 0; i < lags; i++) {
+        x[n + i] = 0.0;
+    }
+
+    return x;
+}
+
+void wordalyzer::reserve_autocorrelation_scratch(autocorrelation_scratch_t& scratch, size_t n, int p)
+{
+    size_t fft_size = get_fft_size(n, p);
+    get_fft_plan(fft_size);
+
+    size_t samples = max(n + 2 * get_direct_lags(p), fft_size);
+    if (scratch.samples.size() < samples) {
+        scratch.samples.resize(samples);
+    }
+    if (scratch.spectrum.size() < fft_size / 2 + 1) {
+        scratch.spectrum.resize(fft_size / 2 + 1);
+    }
+}
+
+void wordalyzer::autocorrelate(const float* samples, size_t n, int p, double* R, autocorrelation_scratch_t& scratch)
+{
+    static const autocorrelation_kernel kernel = get_autocorrelation_kernel();
+
+    int lags = get_direct_lags(p);
+    double* x = load_padded_samples(samples, n, lags, scratch);
+    double* res = x + n + lags;
+
+    kernel(x, n, lags, res);
+
+    for (int k = 0; k <= p; k++) {
+        R[k] = res[k];
+    }
+}
+
+template<int P>
+void wordalyzer::autocorrelate_fixed(const float* samples, size_t n, double* R, autocorrelation_scratch_t& scratch)
+{
+    const int LAGS = (P + 1 + 3) / 4 * 4;
+    static const autocorrelation_group_kernel kernel = get_fixed_autocorrelation_kernel<LAGS>();
+
+    double* x = load_padded_samples(samples, n, LAGS, scratch);
+    double res[LAGS];
+
+    kernel(x, n, 0, res);
+
+    for (int k = 0; k <= P; k++) {
+        R[k] = res[k];
+    }
+}
+
+void wordalyzer::autocorrelate_fft(const float* samples, size_t n, int p, double* R, autocorrelation_scratch_t& scratch)
+{
+    const fft_plan& plan = get_fft_plan(get_fft_size(n, p));
+    size_t size = plan.get_size();
+
+    if (scratch.samples.size() < size) {
+        scratch.samples.resize(size);
+    }
+    if (scratch.spectrum.size() < size / 2 + 1) {
+        scratch.spectrum.resize(size / 2 + 1);
+    }
+
+    double* x = &scratch.samples[0];
+    complex<double>* X = &scratch.spectrum[0];
+    for (size_t i = 0; i < n; i++) {
+        x[i] = samples[i];
+    }
+    for (size_t i = n; i < size; i++) {
+        x[i] = 0.0;
+    }
+
+    plan.forward_real(x, X);
+    for (size_t i = 0; i <= size / 2; i++) {
+        X[i] = norm(X[i]);
+    }
+    plan.inverse_real(X, x);
+
+    for (int k = 0; k <= p; k++) {
+        R[k] = x[k];
+    }
+}
+
+void wordalyzer::slide_autocorrelation(const float* samples, size_t n, size_t stride, int p, double* R)
+{
+    static const dot_product_kernel dot_product = get_dot_product_kernel();
+
+    // For lag k, the products x[j] * x[j - k] with j in [k, stride + k)
+    // leave the frame and those with j in [n, n + stride) enter it.
+    for (int k = 0; k <= p; k++) {
+        double removed = dot_product(samples + k, samples, stride);
+        double added = dot_product(samples + n, samples + n - k, stride);
+        R[k] += added - removed;
+    }
+}
+
+double wordalyzer::get_autocorrelation_work_ratio(size_t n, int p)
+{
+    size_t size = get_fft_size(n, p);
+    double direct = static_cast<double>(n) * get_direct_lags(p);
+    double fft = static_cast<double>(size) * log2(static_cast<double>(size));
+    return direct / fft;
+}
+
+double wordalyzer::get_fft_crossover()
+{
+    // Measured with test/bench_autocorrelation.cpp for frames of 256 to 8192
+    // samples and orders of 8 to 384, and rounded up so that frames near
+    // the crossover keep the more accurate direct sums
+#ifdef WORDALYZER_X86
+    if (cpu_has_avx2()) {
+        return 16.0;
+    }
+
+    if (cpu_has_sse2()) {
+        return 8.0;
+    }
+#endif
+
+    return 2.5;
+}
+
+AutocorrelationMethod wordalyzer::choose_autocorrelation_method(size_t n, int p)
+{
+    static const double crossover = get_fft_crossover();
+    return get_autocorrelation_work_ratio(n, p) > crossover ? AUTOCORRELATION_FFT : AUTOCORRELATION_DIRECT;
+}
+
+template void wordalyzer::autocorrelate_fixed<10>(const float*, size_t, double*, autocorrelation_scratch_t&);
+template void wordalyzer::autocorrelate_fixed<12>(const float*, size_t, double*, autocorrelation_scratch_t&);
+template void wordalyzer::autocorrelate_fixed<16>(const float*, size_t, double*, autocorrelation_scratch_t&);
+template void wordalyzer::autocorrelate_fixed<24>(const float*, size_t, double*, autocorrelation_scratch_t&);
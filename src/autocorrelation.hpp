@@ -0,0 +1,60 @@
+#pragma once
+#include <vector>
+#include <complex>
+#include <cstddef>
+
+namespace wordalyzer {
+    enum AutocorrelationMethod {
+        AUTOCORRELATION_DIRECT,
+        AUTOCORRELATION_FFT
+    };
+
+    // Buffers reused between calls so that autocorrelating a frame does not
+    // allocate once they have grown to the frame size.
+    struct autocorrelation_scratch_t {
+        std::vector<double> samples;
+        std::vector<std::complex<double>> spectrum;
+    };
+
+    // Grows `scratch` to what either method needs for frames of n samples
+    // and lags up to p, and creates the FFT plan for them, so that later
+    // calls do not allocate.
+    void reserve_autocorrelation_scratch(autocorrelation_scratch_t& scratch, size_t n, int p);
+
+    // Computes R[k] = sum(x[i] * x[i + k]) for every lag k in 0..p with a
+    // single conversion pass over the samples, accumulating in double
+    // precision.
+    void autocorrelate(const float* samples, size_t n, int p, double* R, autocorrelation_scratch_t& scratch);
+
+    // Same as autocorrelate(), specialised for a fixed order P so that all
+    // accumulators live on the stack or in registers. Only instantiated for
+    // the orders that have a fixed-order LPC kernel (see lpc.cpp).
+    template<int P>
+    void autocorrelate_fixed(const float* samples, size_t n, double* R, autocorrelation_scratch_t& scratch);
+
+    // Computes the same lags as autocorrelate() through the power spectrum
+    // (Wiener-Khinchin), in O(n log n) regardless of p.
+    void autocorrelate_fft(const float* samples, size_t n, int p, double* R, autocorrelation_scratch_t& scratch);
+
+    // Moves R[0..p] from the frame of n samples starting at `samples` to the
+    // frame starting at samples + stride, by removing the products that
+    // leave the frame and adding the ones that enter it. Costs O(stride * p)
+    // instead of O(n * p); requires stride + p < n. Rounding errors
+    // accumulate, so R should be recomputed exactly every now and then.
+    void slide_autocorrelation(const float* samples, size_t n, size_t stride, int p, double* R);
+
+    // The direct kernels cost about n * lags multiply-adds and the FFT about
+    // N log2(N) butterflies for its padded size N. Returns the first over
+    // the second for frames of n samples and lags up to p.
+    double get_autocorrelation_work_ratio(size_t n, int p);
+
+    // The work ratio above which the FFT is faster than the direct kernel
+    // this CPU uses
+    double get_fft_crossover();
+
+    // Picks the faster method for a given frame size and order from a cost
+    // model fitted to benchmarks of both. The choice only depends on (n, p)
+    // and the instruction set, so the same input always gives the same
+    // coefficients.
+    AutocorrelationMethod choose_autocorrelation_method(size_t n, int p);
+}
@@ -3,50 +3,23 @@
 using namespace wordalyzer;
 using namespace std;
 
-void wordalyzer::serialize_size(size_t sz, vector<byte>& dest)
+void wordalyzer::store_le(uint64_t value, size_t size, byte* dest)
 {
-    for (size_t i = 0; i < sizeof(sz); i++) {
-        dest.push_back(static_cast<byte>(sz >> (8 * i)));
+    for (size_t i = 0; i < size; i++) {
+        dest[i] = static_cast<byte>(value >> (8 * i));
     }
 }
 
-void wordalyzer::serialize_double(double d, vector<byte>& dest)
+uint64_t wordalyzer::load_le(const byte* src, size_t size)
 {
-    union {
-        double d;
-        byte b[sizeof(double)];
-    } u;
-    u.d = d;
-
-    for (size_t i = 0; i < sizeof(d); i++) {
-        dest.push_back(u.b[i]);
-    }
-}
-
-size_t wordalyzer::deserialize_size(vector<byte>::const_iterator& it)
-{
-    size_t res = 0;
-    for (size_t i = 0; i < sizeof(size_t); i++) {
-        res |= static_cast<size_t>(*it++) << (8 * i);
+    uint64_t res = 0;
+    for (size_t i = 0; i < size; i++) {
+        res |= static_cast<uint64_t>(src[i]) << (8 * i);
     }
 
     return res;
 }
 
-double wordalyzer::deserialize_double(vector<byte>::const_iterator& it)
-{
-    union {
-        double d;
-        byte b[sizeof(double)];
-    } u;
-
-    for (size_t i = 0; i < sizeof(double); i++) {
-        u.b[i] = *it++;
-    }
-
-    return u.d;
-}
-
 bool wordalyzer::starts_with(const string& s, const string& prefix)
 {
     if (s.length() < prefix.length()) {
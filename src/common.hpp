@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <vector>
 #include <string>
 #include <exception>
@@ -6,11 +7,9 @@
 namespace wordalyzer {
     typedef unsigned char byte;
 
-    void serialize_size(size_t sz, std::vector<byte>& dest);
-    void serialize_double(double d, std::vector<byte>& dest);
-
-    size_t deserialize_size(std::vector<byte>::const_iterator& it);
-    double deserialize_double(std::vector<byte>::const_iterator& it);
+    // Little-endian integers of `size` bytes, at any alignment
+    void store_le(std::uint64_t value, size_t size, byte* dest);
+    std::uint64_t load_le(const byte* src, size_t size);
 
     bool starts_with(const std::string& s, const std::string& prefix);
     bool ends_with(const std::string& s, const std::string& suffix);
@@ -1,11 +1,30 @@
 #include <sqlite3.h>
-#include <string.h>
+#include <algorithm>
+#include <limits>
 
 #include "database.hpp"
 
 using namespace wordalyzer;
 using namespace std;
 
+namespace wordalyzer {
+    // Closes a blob when it goes out of scope
+    class blob_handle {
+    private:
+        sqlite3_blob* blob;
+
+    public:
+        blob_handle(sqlite3_blob* _blob) : blob(_blob) {}
+        blob_handle(const blob_handle&) = delete;
+        blob_handle& operator=(const blob_handle&) = delete;
+
+        ~blob_handle()
+        {
+            sqlite3_blob_close(blob);
+        }
+    };
+}
+
 int wordalyzer::database::check_ret(int ret)
 {
     if (ret != SQLITE_OK && ret != SQLITE_DONE && ret != SQLITE_ROW) {
@@ -19,6 +38,92 @@ int wordalyzer::database::check_ret(int ret)
     return ret;
 }
 
+wordalyzer::database::cached_statement::~cached_statement()
+{
+    if (in_use != nullptr) {
+        // Errors of the last step are reported again by reset, and have
+        // already been reported when they happened
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        *in_use = false;
+    } else {
+        sqlite3_finalize(stmt);
+    }
+}
+
+wordalyzer::database::transaction::transaction(database& _owner) :
+    owner(_owner), finished(false)
+{
+    // Take the write lock right away. A deferred transaction that has to
+    // upgrade its lock fails at once if another connection is writing,
+    // rather than waiting for it.
+    owner.check_ret(sqlite3_exec(owner.db, "BEGIN IMMEDIATE TRANSACTION", nullptr, 0, nullptr));
+}
+
+void wordalyzer::database::transaction::commit()
+{
+    owner.check_ret(sqlite3_exec(owner.db, "COMMIT TRANSACTION", nullptr, 0, nullptr));
+    finished = true;
+}
+
+wordalyzer::database::transaction::~transaction()
+{
+    if (!finished) {
+        sqlite3_exec(owner.db, "ROLLBACK TRANSACTION", nullptr, 0, nullptr);
+    }
+}
+
+wordalyzer::database::cached_statement wordalyzer::database::prepare(const char* statement_str)
+{
+    auto it = statements.find(statement_str);
+    if (it != statements.end() && !it->second.in_use) {
+        it->second.in_use = true;
+        return cached_statement(it->second.stmt, &it->second.in_use);
+    }
+
+    // Cached statements are kept for as long as the database is open,
+    // which SQLite is told so it can allocate them accordingly
+    bool cached = it == statements.end();
+    sqlite3_stmt* stmt = nullptr;
+    check_ret(sqlite3_prepare_v3(db,
+                                 statement_str,
+                                 -1,
+                                 cached ? SQLITE_PREPARE_PERSISTENT : 0,
+                                 &stmt,
+                                 nullptr));
+    if (!cached) {
+        return cached_statement(stmt, nullptr);
+    }
+
+    // Elements of the map stay where they are when it grows
+    statement_entry& entry = statements[statement_str];
+    entry.stmt = stmt;
+    entry.in_use = true;
+    return cached_statement(stmt, &entry.in_use);
+}
+
+wordalyzer::database::word_cursor::word_cursor(database& _owner, cached_statement&& _statement) :
+    owner(_owner), statement(std::move(_statement)), index(-1) {}
+
+bool wordalyzer::database::word_cursor::next()
+{
+    if (owner.check_ret(sqlite3_step(statement)) != SQLITE_ROW) {
+        current = word_view_t();
+        return false;
+    }
+
+    int new_index = sqlite3_column_int(statement, 0);
+    if (new_index != index + 1) {
+        throw database_exception(-1, "Word indexes in a clip not valid, the database might be corrupted.");
+    }
+
+    const byte* word_bytes = static_cast<const byte*>(sqlite3_column_blob(statement, 1));
+    size_t word_size = sqlite3_column_bytes(statement, 1);
+    current = view_word(word_bytes, word_size, buffer);
+    index = new_index;
+    return true;
+}
+
 const char* wordalyzer::database::get_schema()
 {
     return
@@ -26,7 +131,9 @@ const char* wordalyzer::database::get_schema()
         "   name TEXT PRIMARY KEY,"
         "   vector_size INTEGER,"
         "   window_size INTEGER,"
-        "   window_stride INTEGER);"
+        "   window_stride INTEGER,"
+        "   precision INTEGER DEFAULT 0,"
+        "   sample_rate INTEGER DEFAULT 0);"
 
         "CREATE TABLE IF NOT EXISTS word("
         "   clip_name TEXT,"
@@ -38,37 +145,106 @@ const char* wordalyzer::database::get_schema()
         "   ON word(clip_name);";
 }
 
-wordalyzer::database::database(const std::string& filename) : db(nullptr)
+wordalyzer::database::database(const std::string& filename, const database_options_t& options) : db(nullptr)
 {
-    check_ret(sqlite3_open(filename.c_str(), &db));
+    // Each connection is only used by one thread at a time, so SQLite does
+    // not need to lock it
+    int flags = SQLITE_OPEN_NOMUTEX;
+    if (options.read_only) {
+        flags |= SQLITE_OPEN_READONLY;
+    } else {
+        flags |= SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+    }
 
-    // Create the schema. This is done every time, as the schema contains
-    // IF NOT EXISTS clauses.
-    const char* schema = get_schema();
-    check_ret(sqlite3_exec(db, schema, nullptr, 0, nullptr));
+    int ret = sqlite3_open_v2(filename.c_str(), &db, flags, nullptr);
+    if (ret != SQLITE_OK) {
+        // The handle is allocated even when opening fails
+        string message = db != nullptr ? sqlite3_errmsg(db) : "An SQLite initialization error has occurred.";
+        sqlite3_close(db);
+        throw database_exception(ret, message);
+    }
+
+    try {
+        apply_options(options);
+
+        if (!options.read_only) {
+            // Create the schema. This is done every time, as the schema
+            // contains IF NOT EXISTS clauses.
+            const char* schema = get_schema();
+            check_ret(sqlite3_exec(db, schema, nullptr, 0, nullptr));
+            upgrade_schema();
+        }
+    } catch (...) {
+        sqlite3_close(db);
+        throw;
+    }
+}
+
+void wordalyzer::database::apply_options(const database_options_t& options)
+{
+    check_ret(sqlite3_busy_timeout(db, options.busy_timeout_ms));
+
+    // The journal mode is stored in the file, so read-only connections
+    // use whatever the writer chose
+    if (!options.read_only) {
+        const char* journal_mode = options.wal ? "PRAGMA journal_mode = WAL" : "PRAGMA journal_mode = DELETE";
+        check_ret(sqlite3_exec(db, journal_mode, nullptr, 0, nullptr));
+    }
+
+    // With a write-ahead log, syncing only at checkpoints still keeps the
+    // database consistent, only the last commits can be lost on power loss
+    string pragmas =
+        string("PRAGMA synchronous = ") + (options.wal ? "NORMAL" : "FULL") + ";"
+        "PRAGMA cache_size = " + to_string(-options.cache_size_kb) + ";"
+        "PRAGMA mmap_size = " + to_string(options.mmap_size) + ";";
+    check_ret(sqlite3_exec(db, pragmas.c_str(), nullptr, 0, nullptr));
+}
+
+void wordalyzer::database::upgrade_schema()
+{
+    // Columns added to the clip table after it was first created, which
+    // older databases lack. Their defaults describe the clips those
+    // databases hold: all of them are stored in double precision, and
+    // were analyzed at a rate that was not recorded.
+    const char* added_columns[][2] = {
+        { "precision", "INTEGER DEFAULT 0" },
+        { "sample_rate", "INTEGER DEFAULT 0" }
+    };
+
+    for (auto& column : added_columns) {
+        string probe_statement_str = string("SELECT ") + column[0] + " FROM clip LIMIT 0";
+
+        sqlite3_stmt* probe_statement = nullptr;
+        int ret = sqlite3_prepare_v3(db,
+                                     probe_statement_str.c_str(),
+                                     probe_statement_str.length() + 1,
+                                     0,
+                                     &probe_statement,
+                                     nullptr);
+        sqlite3_finalize(probe_statement);
+
+        if (ret != SQLITE_OK) {
+            string alter_statement_str = string("ALTER TABLE clip ADD COLUMN ") + column[0] + " " + column[1];
+            check_ret(sqlite3_exec(db, alter_statement_str.c_str(), nullptr, 0, nullptr));
+        }
+    }
 }
 
 void wordalyzer::database::add_clip(const clip_t& clip)
 {
+    // Checked under the write lock, so that another connection can't add a
+    // clip of the same name in between
+    transaction trans(*this);
     if (clip_exists(clip.name)) {
         throw duplicate_clip_exception(clip.name);
     }
 
-    check_ret(sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, 0, nullptr));
-
     // Add the clip entry
-    const char clip_statement_str[] =
-        "INSERT INTO clip (name, vector_size, window_size, window_stride)"
-        "   VALUES (?, ?, ?, ?)";
+    {
+        cached_statement clip_statement = prepare(
+            "INSERT INTO clip (name, vector_size, window_size, window_stride, precision, sample_rate)"
+            "   VALUES (?, ?, ?, ?, ?, ?)");
 
-    sqlite3_stmt* clip_statement = nullptr;
-    check_ret(sqlite3_prepare_v3(db,
-                                 clip_statement_str,
-                                 sizeof(clip_statement_str),
-                                 0,
-                                 &clip_statement,
-                                 nullptr));
-    try {
         check_ret(sqlite3_bind_text(clip_statement,
                                     1,
                                     clip.name.c_str(),
@@ -77,30 +253,18 @@ void wordalyzer::database::add_clip(const clip_t& clip)
         check_ret(sqlite3_bind_int(clip_statement, 2, clip.vector_size));
         check_ret(sqlite3_bind_int(clip_statement, 3, clip.window_size));
         check_ret(sqlite3_bind_int(clip_statement, 4, clip.window_stride));
+        check_ret(sqlite3_bind_int(clip_statement, 5, clip.precision));
+        check_ret(sqlite3_bind_int(clip_statement, 6, clip.sample_rate));
 
         check_ret(sqlite3_step(clip_statement));
-    } catch (database_exception& e) {
-        sqlite3_finalize(clip_statement);
-        check_ret(sqlite3_exec(db, "ROLLBACK TRANSACTION", nullptr, 0, nullptr));
-        throw e;
     }
 
-    sqlite3_finalize(clip_statement);
-
     // Add the word entries for words in the clip
-    const char word_statement_str[] =
-        "INSERT INTO word (clip_name, word_index, vectors_serialized)"
-        "   VALUES (?, ?, ?)";
+    {
+        cached_statement word_statement = prepare(
+            "INSERT INTO word (clip_name, word_index, vectors_serialized)"
+            "   VALUES (?, ?, ?)");
 
-    sqlite3_stmt* word_statement = nullptr;
-    check_ret(sqlite3_prepare_v3(db,
-                                 word_statement_str,
-                                 sizeof(word_statement_str),
-                                 0,
-                                 &word_statement,
-                                 nullptr));
-
-    try {
         check_ret(sqlite3_bind_text(word_statement,
                                     1,
                                     clip.name.c_str(),
@@ -119,210 +283,243 @@ void wordalyzer::database::add_clip(const clip_t& clip)
             check_ret(sqlite3_step(word_statement));
             check_ret(sqlite3_reset(word_statement));
         }
-    } catch  (database_exception& e) {
-        sqlite3_finalize(word_statement);
-        check_ret(sqlite3_exec(db, "ROLLBACK TRANSACTION", nullptr, 0, nullptr));
-        throw e;
     }
 
-    check_ret(sqlite3_exec(db, "COMMIT TRANSACTION", nullptr, 0, nullptr));
-    sqlite3_finalize(word_statement);
+    trans.commit();
 }
 
 bool wordalyzer::database::clip_exists(const string& name)
 {
-    const char select_statement_str[] =
-        "SELECT name FROM clip WHERE name = ?";
+    cached_statement select_statement = prepare(
+        "SELECT name FROM clip WHERE name = ?");
 
-    sqlite3_stmt* select_statement = nullptr;
-    check_ret(sqlite3_prepare_v3(db,
-                                 select_statement_str,
-                                 sizeof(select_statement_str),
-                                 0,
-                                 &select_statement,
-                                 nullptr));
-    try {
-        check_ret(sqlite3_bind_text(select_statement,
-                                            1,
-                                            name.c_str(),
-                                            name.length(),
-                                            SQLITE_TRANSIENT));
-
-        int ret = check_ret(sqlite3_step(select_statement));
-        sqlite3_finalize(select_statement);
-        return ret == SQLITE_ROW;
-    } catch (database_exception& e) {
-        sqlite3_finalize(select_statement);
-        throw e;
-    }
+    check_ret(sqlite3_bind_text(select_statement,
+                                1,
+                                name.c_str(),
+                                name.length(),
+                                SQLITE_TRANSIENT));
+
+    return check_ret(sqlite3_step(select_statement)) == SQLITE_ROW;
 }
 
 vector<string> wordalyzer::database::get_all_clip_names()
 {
-    const char select_statement_str[] =
-        "SELECT name FROM clip;";
-
-    sqlite3_stmt* select_statement;
-    check_ret(sqlite3_prepare_v3(db,
-                                 select_statement_str,
-                                 sizeof(select_statement_str),
-                                 0,
-                                 &select_statement,
-                                 nullptr));
-
-    try {
-        vector<string> results;
-        while (check_ret(sqlite3_step(select_statement)) == SQLITE_ROW) {
-            const unsigned char* name = sqlite3_column_text(select_statement, 0);
-            if (name != nullptr) {
-                results.push_back(reinterpret_cast<const char*>(name));
-            }
+    cached_statement select_statement = prepare(
+        "SELECT name FROM clip");
+
+    vector<string> results;
+    while (check_ret(sqlite3_step(select_statement)) == SQLITE_ROW) {
+        const unsigned char* name = sqlite3_column_text(select_statement, 0);
+        if (name != nullptr) {
+            results.push_back(reinterpret_cast<const char*>(name));
         }
-
-        sqlite3_finalize(select_statement);
-        return results;
-    } catch (database_exception& e) {
-        sqlite3_finalize(select_statement);
-        throw e;
     }
+
+    return results;
 }
 
 void wordalyzer::database::remove_clip(const string& clip_name)
 {
-    const char clip_statement_str[] =
-        "DELETE FROM clip WHERE name = ?";
+    transaction trans(*this);
 
-    check_ret(sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, 0, nullptr));
+    {
+        cached_statement clip_statement = prepare(
+            "DELETE FROM clip WHERE name = ?");
 
-    sqlite3_stmt* clip_statement;
-    check_ret(sqlite3_prepare_v3(db,
-                                 clip_statement_str,
-                                 sizeof(clip_statement_str),
-                                 0,
-                                 &clip_statement,
-                                 nullptr));
-
-    try {
         check_ret(sqlite3_bind_text(clip_statement,
                                     1,
                                     clip_name.c_str(),
                                     clip_name.length(),
                                     SQLITE_TRANSIENT));
-
         check_ret(sqlite3_step(clip_statement));
-    } catch (database_exception& e) {
-        sqlite3_finalize(clip_statement);
-        check_ret(sqlite3_exec(db, "ROLLBACK TRANSACTION", nullptr, 0, nullptr));
-        throw e;
     }
 
-    sqlite3_finalize(clip_statement);
-
-    const char word_statement_str[] =
-        "DELETE FROM word WHERE clip_name = ?";
-
-    sqlite3_stmt* word_statement;
-    check_ret(sqlite3_prepare_v3(db,
-                                 word_statement_str,
-                                 sizeof(word_statement_str),
-                                 0,
-                                 &word_statement,
-                                 nullptr));
+    {
+        cached_statement word_statement = prepare(
+            "DELETE FROM word WHERE clip_name = ?");
 
-    try {
         check_ret(sqlite3_bind_text(word_statement,
                                     1,
                                     clip_name.c_str(),
                                     clip_name.length(),
                                     SQLITE_TRANSIENT));
         check_ret(sqlite3_step(word_statement));
-    } catch (database_exception& e) {
-        sqlite3_finalize(word_statement);
-        check_ret(sqlite3_exec(db, "ROLLBACK TRANSACTION", nullptr, 0, nullptr));
-        throw e;
     }
 
-    check_ret(sqlite3_exec(db, "COMMIT TRANSACTION", nullptr, 0, nullptr));
-    sqlite3_finalize(word_statement);
+    trans.commit();
 }
 
-clip_t wordalyzer::database::get_clip(const string& clip_name)
+clip_t wordalyzer::database::get_clip_info(const string& clip_name)
 {
-    const char clip_statement_str[] =
-        "SELECT vector_size, window_size, window_stride FROM clip WHERE name = ?";
+    cached_statement clip_statement = prepare(
+        "SELECT vector_size, window_size, window_stride, precision, sample_rate FROM clip WHERE name = ?");
 
-    sqlite3_stmt* clip_statement = nullptr;
-    check_ret(sqlite3_prepare_v3(db,
-                                 clip_statement_str,
-                                 sizeof(clip_statement_str),
-                                 0,
-                                 &clip_statement,
-                                 nullptr));
+    check_ret(sqlite3_bind_text(clip_statement,
+                                1,
+                                clip_name.c_str(),
+                                clip_name.length(),
+                                SQLITE_TRANSIENT));
+
+    if (check_ret(sqlite3_step(clip_statement)) != SQLITE_ROW) {
+        throw no_such_clip_exception(clip_name);
+    }
 
     clip_t result;
-    try {
-        check_ret(sqlite3_bind_text(clip_statement,
-                                    1,
-                                    clip_name.c_str(),
-                                    clip_name.length(),
-                                    SQLITE_TRANSIENT));
+    result.name = clip_name;
+    result.vector_size = sqlite3_column_int(clip_statement, 0);
+    result.window_size = sqlite3_column_int(clip_statement, 1);
+    result.window_stride = sqlite3_column_int(clip_statement, 2);
+    result.precision = static_cast<Precision>(sqlite3_column_int(clip_statement, 3));
+    result.sample_rate = sqlite3_column_int(clip_statement, 4);
+    return result;
+}
 
-        int ret = check_ret(sqlite3_step(clip_statement));
+wordalyzer::database::word_cursor wordalyzer::database::scan_clip_words(const string& clip_name)
+{
+    cached_statement word_statement = prepare(
+        "SELECT word_index, vectors_serialized FROM word WHERE clip_name = ? ORDER BY word_index");
 
-        if (ret == SQLITE_ROW) {
-            result.vector_size = sqlite3_column_int(clip_statement, 0);
-            result.window_size = sqlite3_column_int(clip_statement, 1);
-            result.window_stride = sqlite3_column_int(clip_statement, 2);
-        } else {
-            throw no_such_clip_exception(clip_name);
-        }
-    } catch (database_exception& e) {
-        sqlite3_finalize(clip_statement);
-        throw e;
+    check_ret(sqlite3_bind_text(word_statement,
+                                1,
+                                clip_name.c_str(),
+                                clip_name.length(),
+                                SQLITE_TRANSIENT));
+
+    return word_cursor(*this, std::move(word_statement));
+}
+
+clip_t wordalyzer::database::get_clip(const string& clip_name)
+{
+    clip_t result = get_clip_info(clip_name);
+
+    word_cursor cursor = scan_clip_words(clip_name);
+    while (cursor.next()) {
+        result.words.push_back(copy_word(cursor.get()));
+    }
+
+    return result;
+}
+
+template<typename T>
+void wordalyzer::database::read_blob_frames(sqlite3_blob* blob,
+                                            const word_layout_t& layout,
+                                            size_t first_frame,
+                                            frame_matrix<T>& coeffs)
+{
+    size_t row_bytes = layout.order * sizeof(T);
+    if (coeffs.get_frames() > 0 && row_bytes > 0) {
+        check_ret(sqlite3_blob_read(blob,
+                                    coeffs.data(),
+                                    coeffs.get_frames() * row_bytes,
+                                    layout.payload_offset + first_frame * row_bytes));
+        fix_coeff_byte_order(layout, coeffs.data(), coeffs.get_frames() * layout.order);
     }
+}
 
-    sqlite3_finalize(clip_statement);
+word_t wordalyzer::database::get_clip_word(const string& clip_name, int word_idx)
+{
+    return get_clip_word(clip_name, word_idx, 0, numeric_limits<size_t>::max());
+}
 
-    const char word_statement_str[] =
-        "SELECT word_index, vectors_serialized FROM word WHERE clip_name = ? ORDER BY word_index";
+word_t wordalyzer::database::get_clip_word(const string& clip_name,
+                                           int word_idx,
+                                           size_t first_frame,
+                                           size_t frame_count)
+{
+    sqlite3_int64 rowid;
+    {
+        cached_statement rowid_statement = prepare(
+            "SELECT rowid FROM word WHERE clip_name = ? AND word_index = ?");
 
-    sqlite3_stmt* word_statement = nullptr;
-    check_ret(sqlite3_prepare_v3(db,
-                                 word_statement_str,
-                                 sizeof(word_statement_str),
-                                 0,
-                                 &word_statement,
-                                 nullptr));
-    try {
-        check_ret(sqlite3_bind_text(word_statement,
+        check_ret(sqlite3_bind_text(rowid_statement,
                                     1,
                                     clip_name.c_str(),
                                     clip_name.length(),
                                     SQLITE_TRANSIENT));
+        check_ret(sqlite3_bind_int(rowid_statement, 2, word_idx));
 
-        int next_index = 0;
-        while (check_ret(sqlite3_step(word_statement)) == SQLITE_ROW) {
-            int new_index = sqlite3_column_int(word_statement, 0);
-            if (new_index != next_index++) {
-                throw database_exception(-1, "Word indexes in a clip not valid, the database might be corrupted.");
-            }
+        if (check_ret(sqlite3_step(rowid_statement)) != SQLITE_ROW) {
+            throw no_such_word_exception(clip_name, word_idx);
+        }
 
-            vector<byte> word_bytes;
-            word_bytes.resize(sqlite3_column_bytes(word_statement, 1));
-            memcpy(&word_bytes[0], sqlite3_column_blob(word_statement, 1), word_bytes.size());
+        rowid = sqlite3_column_int64(rowid_statement, 0);
+    }
 
-            result.words.push_back(deserialize_word(word_bytes));
-        }
-    } catch (database_exception& e) {
-        sqlite3_finalize(word_statement);
-        throw e;
+    sqlite3_blob* blob = nullptr;
+    int ret = sqlite3_blob_open(db, "main", "word", "vectors_serialized", rowid, 0, &blob);
+    blob_handle handle(blob);
+    check_ret(ret);
+
+    // Only the header and the requested frames are read
+    size_t blob_size = sqlite3_blob_bytes(blob);
+    byte header[WORD_HEADER_SIZE];
+    check_ret(sqlite3_blob_read(blob, header, min(WORD_HEADER_SIZE, blob_size), 0));
+    word_layout_t layout = read_word_layout(header, blob_size);
+
+    // A range past the end of the word gives no frames, of the word's order
+    word_t result;
+    result.precision = layout.precision;
+    size_t count = first_frame < layout.frames ? min(frame_count, layout.frames - first_frame) : 0;
+    if (layout.precision == PRECISION_SINGLE) {
+        result.single_coeffs.resize(count, layout.order);
+        read_blob_frames(blob, layout, first_frame, result.single_coeffs);
+    } else {
+        result.coeffs.resize(count, layout.order);
+        read_blob_frames(blob, layout, first_frame, result.coeffs);
     }
 
-    sqlite3_finalize(word_statement);
     return result;
 }
 
 wordalyzer::database::~database()
 {
+    for (auto& entry : statements) {
+        sqlite3_finalize(entry.second.stmt);
+    }
+
     sqlite3_close(db);
 }
+
+wordalyzer::database_pool::lease::~lease()
+{
+    if (connection != nullptr) {
+        pool->release(connection);
+    }
+}
+
+wordalyzer::database_pool::database_pool(const string& filename,
+                                         size_t size,
+                                         const database_options_t& options)
+{
+    if (size == 0) {
+        throw database_exception(SQLITE_MISUSE, "A database pool needs at least one connection.");
+    }
+
+    database_options_t read_options = options;
+    read_options.read_only = true;
+
+    for (size_t i = 0; i < size; i++) {
+        connections.emplace_back(new database(filename, read_options));
+        free_connections.push_back(connections.back().get());
+    }
+}
+
+wordalyzer::database_pool::lease wordalyzer::database_pool::acquire()
+{
+    unique_lock<std::mutex> lock(mutex);
+    connection_freed.wait(lock, [this] { return !free_connections.empty(); });
+
+    database* connection = free_connections.back();
+    free_connections.pop_back();
+    return lease(this, connection);
+}
+
+void wordalyzer::database_pool::release(database* connection)
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        free_connections.push_back(connection);
+    }
+
+    connection_freed.notify_one();
+}
@@ -1,11 +1,18 @@
 #pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <exception>
 
 #include "audio.hpp"
 
 struct sqlite3;
+struct sqlite3_stmt;
+struct sqlite3_blob;
 
 namespace wordalyzer {
     class database_exception : public std::exception {
@@ -44,6 +51,20 @@ namespace wordalyzer {
         }
     };
 
+    class no_such_word_exception : public std::exception {
+    private:
+        std::string message;
+
+    public:
+        no_such_word_exception(const std::string& clip_name, int word_idx) :
+            message("Index " + std::to_string(word_idx) + " is out of range for clip `" + clip_name + "`") {}
+
+        const char* what() const throw()
+        {
+            return message.c_str();
+        }
+    };
+
     class duplicate_clip_exception : public std::exception {
     private:
         std::string message;
@@ -58,24 +79,217 @@ namespace wordalyzer {
         }
     };
 
+    // How a connection to a database is opened
+    struct database_options_t {
+        // Only read the database, without creating or upgrading its schema
+        bool read_only;
+
+        // Log writes ahead instead of journaling them, so that readers and
+        // a writer do not block each other, and sync to disk only at
+        // checkpoints rather than on every commit
+        bool wal;
+
+        // Size of the page cache, in KiB
+        int cache_size_kb;
+
+        // How much of the file is read through a memory mapping, in bytes,
+        // 0 to read it with system calls
+        std::int64_t mmap_size;
+
+        // How long to wait for a lock held by another connection
+        int busy_timeout_ms;
+
+        database_options_t() :
+            read_only(false),
+            wal(true),
+            cache_size_kb(16 * 1024),
+            mmap_size(256 * 1024 * 1024),
+            busy_timeout_ms(5000) {}
+    };
+
+    // A connection to a database. It may be used by one thread at a time.
     class database {
     private:
+        // A prepared statement borrowed from the cache. It is reset and its
+        // bindings are cleared when it goes out of scope, so that it is
+        // ready for the next use even if an exception was thrown. A
+        // statement that was already borrowed when it was asked for again
+        // is prepared anew, and finalized instead.
+        class cached_statement {
+        private:
+            sqlite3_stmt* stmt;
+
+            // The cache's flag for the statement, null if it is not cached
+            bool* in_use;
+
+        public:
+            cached_statement(sqlite3_stmt* _stmt, bool* _in_use) : stmt(_stmt), in_use(_in_use) {}
+            cached_statement(cached_statement&& other) : stmt(other.stmt), in_use(other.in_use)
+            {
+                other.stmt = nullptr;
+                other.in_use = nullptr;
+            }
+            cached_statement(const cached_statement&) = delete;
+            cached_statement& operator=(const cached_statement&) = delete;
+
+            operator sqlite3_stmt*() const
+            {
+                return stmt;
+            }
+
+            ~cached_statement();
+        };
+
+        // A transaction that is rolled back when it goes out of scope
+        // without being committed
+        class transaction {
+        private:
+            database& owner;
+            bool finished;
+
+        public:
+            transaction(database& _owner);
+            transaction(const transaction&) = delete;
+            transaction& operator=(const transaction&) = delete;
+
+            void commit();
+
+            ~transaction();
+        };
+
         sqlite3* db;
 
+        struct statement_entry {
+            sqlite3_stmt* stmt;
+            bool in_use;
+        };
+
+        // Statements prepared so far, by their SQL text. They are only
+        // finalized when the database is closed.
+        std::unordered_map<std::string, statement_entry> statements;
+
         int check_ret(int ret);
+        cached_statement prepare(const char* statement_str);
+        void apply_options(const database_options_t& options);
+        void upgrade_schema();
         bool clip_exists(const std::string& name);
         static const char* get_schema();
 
+        // Reads the frames of a word in `blob` from first_frame on into
+        // `coeffs`, which is already sized for them
+        template<typename T>
+        void read_blob_frames(sqlite3_blob* blob, const word_layout_t& layout, size_t first_frame, frame_matrix<T>& coeffs);
+
     public:
-        database(const std::string& filename);
+        // Steps through the words of a clip in order, viewing each where
+        // SQLite holds it if it can. A view is valid until the next call
+        // to next() or until the cursor is destroyed. Nothing is allocated
+        // per word, only when a word is larger than the ones before it
+        // and has to be copied.
+        class word_cursor {
+        private:
+            database& owner;
+            cached_statement statement;
+            word_buffer_t buffer;
+            word_view_t current;
+            int index;
+
+        public:
+            word_cursor(database& _owner, cached_statement&& _statement);
+
+            // Moves to the next word, false if there are no more
+            bool next();
+
+            const word_view_t& get() const
+            {
+                return current;
+            }
+
+            int get_index() const
+            {
+                return index;
+            }
+        };
+
+        database(const std::string& filename, const database_options_t& options = database_options_t());
+        database(const database&) = delete;
+        database& operator=(const database&) = delete;
 
         std::vector<std::string> get_all_clip_names();
         clip_t get_clip(const std::string& clip_name);
+
+        // The parameters of a clip, without its words
+        clip_t get_clip_info(const std::string& clip_name);
+
+        // The words of a clip, which has none if it does not exist
+        word_cursor scan_clip_words(const std::string& clip_name);
+
         void remove_clip(const std::string& clip_name);
         void add_clip(const clip_t& clip);
 
+        // Reads a single word of a clip, or only its frames [first_frame,
+        // first_frame + frame_count), fewer if the word ends before. Only
+        // the bytes of those frames are read from the database.
         word_t get_clip_word(const std::string& clip_name, int word_idx);
+        word_t get_clip_word(const std::string& clip_name,
+                             int word_idx,
+                             size_t first_frame,
+                             size_t frame_count);
 
         ~database();
     };
+
+    // Read-only connections to one database, shared by threads that load
+    // clips in parallel. The database has to exist already. In WAL mode
+    // they keep reading while another connection commits. A pool has at
+    // least one connection.
+    class database_pool {
+    public:
+        // A connection borrowed from the pool, given back when the lease
+        // goes out of scope
+        class lease {
+        private:
+            database_pool* pool;
+            database* connection;
+
+        public:
+            lease(database_pool* _pool, database* _connection) :
+                pool(_pool), connection(_connection) {}
+            lease(lease&& other) : pool(other.pool), connection(other.connection)
+            {
+                other.connection = nullptr;
+            }
+            lease(const lease&) = delete;
+            lease& operator=(const lease&) = delete;
+
+            database* operator->() const
+            {
+                return connection;
+            }
+
+            database& operator*() const
+            {
+                return *connection;
+            }
+
+            ~lease();
+        };
+
+        database_pool(const std::string& filename,
+                      size_t size,
+                      const database_options_t& options = database_options_t());
+        database_pool(const database_pool&) = delete;
+        database_pool& operator=(const database_pool&) = delete;
+
+        // Waits until a connection is free and borrows it
+        lease acquire();
+
+    private:
+        std::vector<std::unique_ptr<database>> connections;
+        std::vector<database*> free_connections;
+        std::mutex mutex;
+        std::condition_variable connection_freed;
+
+        void release(database* connection);
+    };
 }
@@ -2,6 +2,7 @@
 #include <cmath>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
 
 using namespace wordalyzer;
 using namespace wordalyzer::gui;
@@ -10,17 +11,19 @@ using namespace std;
 const int Y_LABEL_COUNT = 10;
 const int MIN_X_WIDTH = 2;
 
-diff_diagram::diff_diagram(vector<vector<double>>::const_iterator begin1,
-                           vector<vector<double>>::const_iterator end1,
-                           vector<vector<double>>::const_iterator begin2,
-                           vector<vector<double>>::const_iterator end2)
+diff_diagram::diff_diagram(const frame_matrix<double>& vectors1, size_t offset1,
+                           const frame_matrix<double>& vectors2, size_t offset2,
+                           size_t count)
 {
+    size_t order = min(vectors1.get_order(), vectors2.get_order());
+
     max_diff = -1.0;
-    for (auto it1 = begin1, it2 = begin2; it1 < end1 && it2 < end2; it1++, it2++) {
+    for (size_t i = 0; i < count && offset1 + i < vectors1.get_frames() && offset2 + i < vectors2.get_frames(); i++) {
         double dist_sq = 0.0;
-        const auto& v1 = *it1, &v2 = *it2;
-        for (int i = 0; i < v1.size(); i++) {
-            dist_sq += (v1[i] - v2[i]) * (v1[i] - v2[i]);
+        const double* v1 = vectors1.row(offset1 + i).data();
+        const double* v2 = vectors2.row(offset2 + i).data();
+        for (size_t j = 0; j < order; j++) {
+            dist_sq += (v1[j] - v2[j]) * (v1[j] - v2[j]);
         }
 
         double dist = sqrt(dist_sq);
@@ -1,5 +1,6 @@
 #pragma once
 #include "gui.hpp"
+#include "frame_matrix.hpp"
 
 namespace wordalyzer::gui {
     class diff_diagram : public diagram {
@@ -9,10 +10,9 @@ namespace wordalyzer::gui {
         int left_i, right_i;
 
     public:
-        diff_diagram(std::vector<std::vector<double>>::const_iterator begin1,
-                     std::vector<std::vector<double>>::const_iterator end1,
-                     std::vector<std::vector<double>>::const_iterator begin2,
-                     std::vector<std::vector<double>>::const_iterator end2);
+        diff_diagram(const frame_matrix<double>& vectors1, size_t offset1,
+                     const frame_matrix<double>& vectors2, size_t offset2,
+                     size_t count);
 
         std::map<float, std::string> get_y_labels();
         std::string get_title() { return "Coefficient vector diff"; }
@@ -1,7 +1,10 @@
 #include "endpointing.hpp"
+#include "simd.hpp"
+#include "wav.hpp"
+#include <algorithm>
 #include <cmath>
-#include <list>
 #include <iostream>
+#include <thread>
 
 using namespace wordalyzer;
 using namespace std;
@@ -19,133 +22,338 @@ namespace wordalyzer {
         size_t start, len;
     };
 
-    float compute_noise_threshold(vector<float>::const_iterator start, vector<float>::const_iterator end);
+    float compute_noise_threshold(const float* samples, size_t count);
 
-    template<typename T>
-    float compute_mean(typename vector<T>::const_iterator start, typename vector<T>::const_iterator end);
+    // Computes the mean absolute value of `count` consecutive windows of
+    // `window_samples` each. Every kernel sums a window in the same order,
+    // eight interleaved partial sums followed by the tail, so the envelope
+    // does not depend on which one runs.
+    typedef void (*envelope_kernel)(const float* samples, size_t count, int window_samples, float* means);
+    void compute_envelope_scalar(const float* samples, size_t count, int window_samples, float* means);
+    envelope_kernel get_envelope_kernel();
+    void compute_envelope(const float* samples, size_t count, int window_samples, float* means);
 
-    list<span_t> to_speech_spans(const vector<bool>& is_speech);
-    void lower_pits(list<span_t>& spans);
-    void raise_peaks(list<span_t>& spans);
+    // Windows are classified in blocks of this many, so that the envelope
+    // stays in cache between being computed and being read.
+    const size_t ENVELOPE_BLOCK_WINDOWS = 1024;
+
+#ifdef WORDALYZER_X86
+    // Number of windows summed at the same time, so that the additions
+    // for different windows hide each other's latency
+    const size_t ENVELOPE_INTERLEAVE = 4;
+
+    WORDALYZER_TARGET_AVX2 void compute_envelope_avx2(const float* samples, size_t count, int window_samples, float* means);
+#endif
+
+    // The samples of an input in memory, read in place
+    class audio_samples {
+    private:
+        const audio_t& audio;
+
+    public:
+        audio_samples(const audio_t& _audio) : audio(_audio) {}
+
+        size_t size() const
+        {
+            return audio.samples.size();
+        }
+
+        // Returns `count` samples starting at `first`, using `buffer` if
+        // they have to be converted first
+        const float* get(size_t first, size_t /* count */, vector<float>& /* buffer */) const
+        {
+            return audio.samples.data() + first;
+        }
+    };
+
+    // The samples of a mapped WAV file, converted as they are read
+    class wav_samples {
+    private:
+        const mapped_wav_file& wav;
+
+    public:
+        wav_samples(const mapped_wav_file& _wav) : wav(_wav) {}
+
+        size_t size() const
+        {
+            return wav.get_total_samples();
+        }
+
+        const float* get(size_t first, size_t count, vector<float>& buffer) const
+        {
+            buffer.resize(count);
+            wav.read_samples(first, count, buffer.data());
+            return buffer.data();
+        }
+    };
+
+    template<typename Source>
+    vector<pair<int, int>> compute_source_endpoints(const Source& source, int sample_rate, int thread_count);
+
+    // Appends the runs of speech among windows [first_window, last_window)
+    // to `runs`. Windows start at sample `first_sample`.
+    template<typename Source>
+    void find_speech_runs(const Source& source,
+                          size_t first_sample,
+                          size_t first_window,
+                          size_t last_window,
+                          int window_samples,
+                          float noise_threshold,
+                          vector<span_t>& runs);
+    void lower_pits(vector<span_t>& spans);
+    void raise_peaks(vector<span_t>& spans);
+
+    // The number of windows of `sample_count` samples, after the noise
+    // sample. Each must be followed by at least one more sample.
+    size_t get_window_count(size_t sample_count, int noise_samples, int window_samples);
+
+    // Long inputs are only split between threads in chunks of at least
+    // this many windows, as shorter ones are not worth starting a thread.
+    const size_t MIN_THREAD_WINDOWS = 16 * 1024;
 }
 
-template<typename T>
-float wordalyzer::compute_mean(typename vector<T>::const_iterator start, typename vector<T>::const_iterator end)
+void wordalyzer::compute_envelope_scalar(const float* samples, size_t count, int window_samples, float* means)
 {
-    float sample_sum = 0.0f;
-    int sample_n = 0;
-    for (auto it = start; it < end; it++) {
-        sample_sum += abs(*it);
-        sample_n++;
-    }
+    for (size_t w = 0; w < count; w++) {
+        const float* x = samples + w * window_samples;
+
+        float lanes[8] = { 0.0f };
+        int i = 0;
+        for (; i + 8 <= window_samples; i += 8) {
+            for (int l = 0; l < 8; l++) {
+                lanes[l] += fabs(x[i + l]);
+            }
+        }
 
-    return sample_sum / sample_n;
+        float sum = ((lanes[0] + lanes[4]) + (lanes[1] + lanes[5])) + ((lanes[2] + lanes[6]) + (lanes[3] + lanes[7]));
+        for (; i < window_samples; i++) {
+            sum += fabs(x[i]);
+        }
+
+        means[w] = sum / window_samples;
+    }
 }
 
-list<span_t> wordalyzer::to_speech_spans(const vector<bool>& is_speech)
+#ifdef WORDALYZER_X86
+WORDALYZER_TARGET_AVX2
+void wordalyzer::compute_envelope_avx2(const float* samples, size_t count, int window_samples, float* means)
 {
-    if (is_speech.empty()) {
-        return list<span_t>();
-    }
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+
+    size_t w = 0;
+    for (; w + ENVELOPE_INTERLEAVE <= count; w += ENVELOPE_INTERLEAVE) {
+        const float* x = samples + w * window_samples;
+
+        __m256 acc[ENVELOPE_INTERLEAVE];
+        for (size_t j = 0; j < ENVELOPE_INTERLEAVE; j++) {
+            acc[j] = _mm256_setzero_ps();
+        }
+
+        int i = 0;
+        for (; i + 8 <= window_samples; i += 8) {
+            for (size_t j = 0; j < ENVELOPE_INTERLEAVE; j++) {
+                __m256 v = _mm256_loadu_ps(x + j * window_samples + i);
+                acc[j] = _mm256_add_ps(acc[j], _mm256_andnot_ps(sign_mask, v));
+            }
+        }
+
+        for (size_t j = 0; j < ENVELOPE_INTERLEAVE; j++) {
+            float lanes[8];
+            _mm256_storeu_ps(lanes, acc[j]);
 
-    bool prev = is_speech[0];
-    size_t start = 0;
-    list<span_t> res;
-    for (size_t i = 0; i < is_speech.size(); i++) {
-        if (prev != is_speech[i]) {
-            if (prev) {
-                res.push_back({ start, i - start });
+            float sum = ((lanes[0] + lanes[4]) + (lanes[1] + lanes[5])) + ((lanes[2] + lanes[6]) + (lanes[3] + lanes[7]));
+            for (int k = i; k < window_samples; k++) {
+                sum += fabs(x[j * window_samples + k]);
             }
-            start = i;
+
+            means[w + j] = sum / window_samples;
         }
-        prev = is_speech[i];
     }
 
-    if (prev) {
-        res.push_back({ start, is_speech.size() - start });
+    compute_envelope_scalar(samples + w * window_samples, count - w, window_samples, means + w);
+}
+#endif
+
+envelope_kernel wordalyzer::get_envelope_kernel()
+{
+#ifdef WORDALYZER_X86
+    if (cpu_has_avx2()) {
+        return compute_envelope_avx2;
     }
+#endif
 
-    return res;
+    return compute_envelope_scalar;
 }
 
-float wordalyzer::compute_noise_threshold(vector<float>::const_iterator start, vector<float>::const_iterator end)
+void wordalyzer::compute_envelope(const float* samples, size_t count, int window_samples, float* means)
 {
-    float mean = compute_mean<float>(start, end);
-    float variance = 0.0f;
+    static const envelope_kernel kernel = get_envelope_kernel();
+    kernel(samples, count, window_samples, means);
+}
+
+float wordalyzer::compute_noise_threshold(const float* samples, size_t count)
+{
+    // The threshold is the mean absolute value plus the deviation of the
+    // samples around it. Expanding sum((x - mean)^2) lets both come from
+    // a single pass; the sums are kept in double so the expansion does not
+    // cancel away the variance.
+    double abs_sum = 0.0, sum = 0.0, square_sum = 0.0;
     int sample_n = 0;
-    for (auto it = start; it < end; it++) {
-        float diff = *it - mean;
-        variance += diff * diff;
+    for (size_t i = 0; i < count; i++) {
+        double x = samples[i];
+        abs_sum += fabs(x);
+        sum += x;
+        square_sum += x * x;
         sample_n++;
     }
 
-    float std_dev = sqrt(variance / sample_n);
+    double mean = abs_sum / sample_n;
+    double variance = square_sum - 2.0 * mean * sum + sample_n * mean * mean;
+    double std_dev = sqrt(max(variance, 0.0) / sample_n);
     return mean + 1 * std_dev;
 }
 
-void wordalyzer::raise_peaks(list<span_t>& spans)
+void wordalyzer::raise_peaks(vector<span_t>& spans)
 {
-    list<span_t>::iterator prev = spans.begin(),
-                           second = spans.begin();
-    second++;
+    if (spans.empty()) {
+        return;
+    }
 
-    for (auto it = second; it != spans.end(); prev = it, it++) {
-        int zeros_before = it->start - prev->start - prev->len;
+    // Compacts the spans in place: `last` is the span the next ones may
+    // be joined to, everything after it is still unprocessed.
+    size_t last = 0;
+    for (size_t i = 1; i < spans.size(); i++) {
+        span_t& prev = spans[last];
+        int zeros_before = spans[i].start - prev.start - prev.len;
         if (zeros_before < PARAM_X) {
             // See if the new sequence of 1's is going to be > Y.
-            int new_ones = prev->len + zeros_before + it->len;
+            int new_ones = prev.len + zeros_before + spans[i].len;
             if (new_ones > PARAM_Y) {
                 // Join the prev and current spans
-                prev->len += zeros_before + it->len;
-                spans.erase(it);
-                it = prev;
+                prev.len += zeros_before + spans[i].len;
+                continue;
             }
         }
+
+        spans[++last] = spans[i];
     }
+
+    spans.resize(last + 1);
+}
+
+void wordalyzer::lower_pits(vector<span_t>& spans)
+{
+    spans.erase(remove_if(spans.begin(), spans.end(), [](const span_t& span) { return span.len < PARAM_Z; }),
+                spans.end());
 }
 
-void wordalyzer::lower_pits(list<span_t>& spans)
+template<typename Source>
+void wordalyzer::find_speech_runs(const Source& source,
+                                  size_t first_sample,
+                                  size_t first_window,
+                                  size_t last_window,
+                                  int window_samples,
+                                  float noise_threshold,
+                                  vector<span_t>& runs)
 {
-    list<span_t>::iterator prev = spans.begin();
+    // Runs of speech windows are turned into spans while scanning, with
+    // the last span growing for as long as its run continues.
+    vector<float> buffer;
+    float means[ENVELOPE_BLOCK_WINDOWS];
+    for (size_t block = first_window; block < last_window; block += ENVELOPE_BLOCK_WINDOWS) {
+        size_t count = min(ENVELOPE_BLOCK_WINDOWS, last_window - block);
+        const float* samples = source.get(first_sample + block * window_samples, count * window_samples, buffer);
+        compute_envelope(samples, count, window_samples, means);
 
-    bool is_first = true;
-    for (auto it = spans.begin(); it != spans.end();) {
-        if (it->len < PARAM_Z) {
-            spans.erase(it);
-            if (is_first) {
-                it = spans.begin();
-            } else {
-                it = prev;
-                it++;
-                is_first = false;
+        for (size_t j = 0; j < count; j++) {
+            if (means[j] > noise_threshold) {
+                if (!runs.empty() && runs.back().start + runs.back().len == block + j) {
+                    runs.back().len++;
+                } else {
+                    runs.push_back({ block + j, 1 });
+                }
             }
-        }  else {
-            is_first = false;
-            prev = it;
-            it++;
         }
+    }
+}
 
+size_t wordalyzer::get_window_count(size_t sample_count, int noise_samples, int window_samples)
+{
+    if (sample_count <= static_cast<size_t>(noise_samples + window_samples)) {
+        return 0;
     }
+
+    return (sample_count - noise_samples - window_samples - 1) / window_samples + 1;
+}
+
+int wordalyzer::get_endpointing_threads(size_t sample_count, int sample_rate, int thread_count)
+{
+    audio_t format;
+    format.sample_rate = sample_rate;
+    if (sample_count < static_cast<size_t>(format.ms_to_samples(MIN_DURATION_MS))) {
+        return 1;
+    }
+
+    size_t window_count = get_window_count(sample_count,
+                                           format.ms_to_samples(NOISE_SAMPLE_MS),
+                                           format.ms_to_samples(WINDOW_SIZE_MS));
+    return max<size_t>(min<size_t>(max(thread_count, 1), window_count / MIN_THREAD_WINDOWS), 1);
 }
 
-vector<pair<int, int>> wordalyzer::compute_endpoints(const audio_t& audio)
+template<typename Source>
+vector<pair<int, int>> wordalyzer::compute_source_endpoints(const Source& source, int sample_rate, int thread_count)
 {
+    audio_t format;
+    format.sample_rate = sample_rate;
+
     // If the audio is too small, just return one single piece
-    if (audio.samples.size() < audio.ms_to_samples(MIN_DURATION_MS)) {
-        return { { 0, audio.samples.size() - 1 } };
+    if (source.size() < static_cast<size_t>(format.ms_to_samples(MIN_DURATION_MS))) {
+        return { { 0, source.size() - 1 } };
     }
 
-    int noise_samples = audio.ms_to_samples(NOISE_SAMPLE_MS);
-    float noise_threshold = compute_noise_threshold(audio.samples.begin(), audio.samples.begin() + noise_samples);
+    vector<float> buffer;
+    int noise_samples = format.ms_to_samples(NOISE_SAMPLE_MS);
+    float noise_threshold = compute_noise_threshold(source.get(0, noise_samples, buffer), noise_samples);
+
+    int window_samples = format.ms_to_samples(WINDOW_SIZE_MS);
+    size_t window_count = get_window_count(source.size(), noise_samples, window_samples);
+
+    vector<span_t> spans;
+    size_t workers = get_endpointing_threads(source.size(), sample_rate, thread_count);
+    if (workers <= 1) {
+        find_speech_runs(source, noise_samples, 0, window_count, window_samples, noise_threshold, spans);
+    } else {
+        // Windows are classified independently, so each worker finds the
+        // runs in its own range. A run cut by a range boundary shows up as
+        // two runs that touch, which are joined back together below.
+        vector<vector<span_t>> runs(workers);
+        vector<thread> threads;
+        for (size_t w = 0; w < workers; w++) {
+            threads.emplace_back(find_speech_runs<Source>,
+                                 cref(source),
+                                 noise_samples,
+                                 window_count * w / workers,
+                                 window_count * (w + 1) / workers,
+                                 window_samples,
+                                 noise_threshold,
+                                 ref(runs[w]));
+        }
+
+        for (auto& t : threads) {
+            t.join();
+        }
 
-    int window_samples = audio.ms_to_samples(WINDOW_SIZE_MS);
-    vector<bool> is_speech;
-    for (int i = noise_samples; i < audio.samples.size() - window_samples; i += window_samples) {
-        float mean = compute_mean<float>(audio.samples.begin() + i, audio.samples.begin() + i + window_samples);
-        is_speech.push_back(mean > noise_threshold);
+        for (const auto& worker_runs : runs) {
+            for (const auto& run : worker_runs) {
+                if (!spans.empty() && spans.back().start + spans.back().len == run.start) {
+                    spans.back().len += run.len;
+                } else {
+                    spans.push_back(run);
+                }
+            }
+        }
     }
 
-    list<span_t> spans = to_speech_spans(is_speech);
     raise_peaks(spans);
     lower_pits(spans);
 
@@ -157,3 +365,185 @@ vector<pair<int, int>> wordalyzer::compute_endpoints(const audio_t& audio)
 
     return res;
 }
+
+vector<pair<int, int>> wordalyzer::compute_endpoints(const audio_t& audio, int thread_count)
+{
+    return compute_source_endpoints(audio_samples(audio), audio.sample_rate, thread_count);
+}
+
+vector<pair<int, int>> wordalyzer::compute_endpoints(const mapped_wav_file& wav, int thread_count)
+{
+    return compute_source_endpoints(wav_samples(wav), wav.get_sample_rate(), thread_count);
+}
+
+wordalyzer::endpointer::endpointer(int sample_rate) :
+    noise_threshold(0.0f), samples_seen(0), window_fill(0), windows(0),
+    has_pending_window(false), pending_is_speech(false),
+    in_run(false), has_span(false), finished(false)
+{
+    audio_t format;
+    format.sample_rate = sample_rate;
+    noise_samples = format.ms_to_samples(NOISE_SAMPLE_MS);
+    window_samples = format.ms_to_samples(WINDOW_SIZE_MS);
+    min_duration_samples = format.ms_to_samples(MIN_DURATION_MS);
+
+    noise.reserve(noise_samples);
+    window.resize(window_samples);
+    if (noise_samples == 0) {
+        noise_threshold = compute_noise_threshold(noise.data(), noise.size());
+    }
+}
+
+void wordalyzer::endpointer::push_samples(const float* samples, size_t n)
+{
+    samples_seen += n;
+
+    // The first samples only serve to estimate the noise level
+    size_t i = 0;
+    if (noise.size() < static_cast<size_t>(noise_samples)) {
+        i = min(n, noise_samples - noise.size());
+        noise.insert(noise.end(), samples, samples + i);
+        if (noise.size() == static_cast<size_t>(noise_samples)) {
+            noise_threshold = compute_noise_threshold(noise.data(), noise.size());
+        }
+    }
+
+    // Windows go through the same kernel as in compute_endpoints(), so
+    // that every one of them is classified the same way
+    while (i < n) {
+        if (has_pending_window) {
+            has_pending_window = false;
+            push_window(pending_is_speech);
+        }
+
+        if (window_fill == 0 && n - i >= static_cast<size_t>(window_samples)) {
+            // Whole windows are read straight from the input
+            float means[ENVELOPE_BLOCK_WINDOWS];
+            size_t count = min(ENVELOPE_BLOCK_WINDOWS, (n - i) / window_samples);
+            compute_envelope(samples + i, count, window_samples, means);
+            for (size_t j = 0; j + 1 < count; j++) {
+                push_window(means[j] > noise_threshold);
+            }
+
+            pending_is_speech = means[count - 1] > noise_threshold;
+            has_pending_window = true;
+            i += count * window_samples;
+        } else {
+            size_t fill = min(n - i, static_cast<size_t>(window_samples - window_fill));
+            copy(samples + i, samples + i + fill, &window[window_fill]);
+            window_fill += fill;
+            i += fill;
+
+            if (window_fill == window_samples) {
+                float mean;
+                compute_envelope(&window[0], 1, window_samples, &mean);
+                pending_is_speech = mean > noise_threshold;
+                has_pending_window = true;
+                window_fill = 0;
+            }
+        }
+    }
+}
+
+void wordalyzer::endpointer::push_window(bool is_speech)
+{
+    if (is_speech) {
+        if (!in_run) {
+            in_run = true;
+            run = { windows, 0 };
+        }
+        run.len++;
+    } else if (in_run) {
+        end_run();
+    }
+    windows++;
+
+    // Any later run would start at least X windows after the span, too far
+    // to join it, so the span is final.
+    if (has_span && !in_run && windows - span.start - span.len >= PARAM_X) {
+        end_span();
+    }
+}
+
+void wordalyzer::endpointer::end_run()
+{
+    in_run = false;
+    if (!has_span) {
+        span = run;
+        has_span = true;
+        return;
+    }
+
+    // Same rule as raise_peaks(), applied as each run ends
+    size_t zeros_before = run.start - span.start - span.len;
+    if (zeros_before < PARAM_X && span.len + zeros_before + run.len > PARAM_Y) {
+        span.len += zeros_before + run.len;
+    } else {
+        end_span();
+        span = run;
+        has_span = true;
+    }
+}
+
+void wordalyzer::endpointer::end_span()
+{
+    has_span = false;
+
+    // Same rule as lower_pits()
+    if (span.len >= PARAM_Z) {
+        int left_w = span.start, right_w = span.start + span.len;
+        words.push_back({ left_w * window_samples + noise_samples, right_w * window_samples + noise_samples - 1 });
+    }
+}
+
+void wordalyzer::endpointer::finish()
+{
+    if (finished) {
+        return;
+    }
+    finished = true;
+
+    // A complete window at the very end is not analyzed, as in
+    // compute_endpoints()
+    has_pending_window = false;
+    if (in_run) {
+        end_run();
+    }
+    if (has_span) {
+        end_span();
+    }
+
+    if (samples_seen < static_cast<size_t>(min_duration_samples)) {
+        words = { { 0, static_cast<int>(samples_seen) - 1 } };
+    }
+}
+
+vector<pair<int, int>> wordalyzer::endpointer::take_words()
+{
+    // Until the input is known to be long enough, it might still end up
+    // being a single piece
+    if (!finished && samples_seen < static_cast<size_t>(min_duration_samples)) {
+        return vector<pair<int, int>>();
+    }
+
+    vector<pair<int, int>> res;
+    res.swap(words);
+    return res;
+}
+
+size_t wordalyzer::endpointer::get_earliest_word_start() const
+{
+    // A short input ends up as a single word starting at 0
+    if (!finished && samples_seen < static_cast<size_t>(min_duration_samples)) {
+        return 0;
+    }
+
+    size_t window = windows;
+    if (has_span) {
+        window = span.start;
+    } else if (in_run) {
+        window = run.start;
+    }
+
+    return window * window_samples + noise_samples;
+}
@@ -4,5 +4,69 @@
 #include "audio.hpp"
 
 namespace wordalyzer {
-    std::vector<std::pair<int, int>> compute_endpoints(const audio_t& audio);
+    class mapped_wav_file;
+
+    // Finds the words in `audio`, as pairs of first and last sample. Long
+    // inputs are split between up to `thread_count` threads, with the same
+    // result as a single thread.
+    std::vector<std::pair<int, int>> compute_endpoints(const audio_t& audio, int thread_count = 1);
+
+    // Same as compute_endpoints() on the samples of `wav`. Each thread
+    // converts the samples of its own range a block at a time, so the file
+    // is never converted as a whole.
+    std::vector<std::pair<int, int>> compute_endpoints(const mapped_wav_file& wav, int thread_count = 1);
+
+    // The number of threads compute_endpoints() splits an input of
+    // `sample_count` samples at `sample_rate` between, given `thread_count`
+    int get_endpointing_threads(size_t sample_count, int sample_rate, int thread_count);
+
+    // Incremental version of compute_endpoints() for audio that arrives in
+    // blocks. Only the noise prefix and the current window are kept, so
+    // memory does not grow with the length of the input. Words are reported
+    // in absolute sample positions once no later input can change them,
+    // and match what compute_endpoints() returns for the whole input.
+    class endpointer {
+    private:
+        // A run of speech windows, in window indices
+        struct run_t {
+            size_t start, len;
+        };
+
+        int noise_samples, window_samples, min_duration_samples;
+        float noise_threshold;
+        std::vector<float> noise;
+        std::vector<float> window;
+
+        size_t samples_seen;
+        int window_fill;
+        size_t windows;
+
+        // The last complete window only counts once a sample follows it
+        bool has_pending_window, pending_is_speech;
+
+        bool in_run, has_span, finished;
+        run_t run, span;
+
+        std::vector<std::pair<int, int>> words;
+
+        void push_window(bool is_speech);
+        void end_run();
+        void end_span();
+
+    public:
+        endpointer(int sample_rate);
+
+        void push_samples(const float* samples, size_t n);
+
+        // Marks the end of the input, finalizing the last word
+        void finish();
+
+        // Returns the words finalized since the last call
+        std::vector<std::pair<int, int>> take_words();
+
+        // Returns the first sample that a word not yet returned by
+        // take_words() can start at. Samples before it are no longer
+        // needed by any word to come.
+        size_t get_earliest_word_start() const;
+    };
 }
@@ -0,0 +1,157 @@
+#include "fft.hpp"
+#include <cassert>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+
+using namespace wordalyzer;
+using namespace std;
+
+namespace wordalyzer {
+    fft_plan::complex_t multiply(fft_plan::complex_t a, fft_plan::complex_t b);
+}
+
+// Plain complex multiplication. The standard operator also handles
+// infinities and NaNs by calling into a slow library routine, which we do
+// not need for finite samples.
+inline fft_plan::complex_t wordalyzer::multiply(fft_plan::complex_t a, fft_plan::complex_t b)
+{
+    return fft_plan::complex_t(a.real() * b.real() - a.imag() * b.imag(),
+                               a.real() * b.imag() + a.imag() * b.real());
+}
+
+// A real transform of length n is computed as a complex transform of
+// length n/2 over the even samples packed with the odd samples, followed
+// by a split into the spectra of both halves.
+fft_plan::fft_plan(size_t _n) : n(_n), half(_n / 2)
+{
+    assert(n >= 2 && (n & (n - 1)) == 0 && "FFT size must be a power of two");
+
+    // Twiddles are stored stage by stage, so that every stage reads its
+    // factors sequentially: the stage with butterflies of length `len`
+    // keeps its len / 2 factors starting at index len / 2 - 1.
+    twiddles.resize(half > 1 ? half - 1 : 0);
+    for (size_t len = 2; len <= half; len *= 2) {
+        for (size_t j = 0; j < len / 2; j++) {
+            twiddles[len / 2 - 1 + j] = polar(1.0, -2.0 * M_PI * j / len);
+        }
+    }
+
+    real_twiddles.resize(half + 1);
+    for (size_t i = 0; i < real_twiddles.size(); i++) {
+        real_twiddles[i] = polar(1.0, -2.0 * M_PI * i / n);
+    }
+
+    int bits = 0;
+    while ((static_cast<size_t>(1) << bits) < half) {
+        bits++;
+    }
+
+    bit_reverse.resize(half);
+    for (size_t i = 0; i < half; i++) {
+        size_t r = 0;
+        for (int b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        bit_reverse[i] = r;
+    }
+}
+
+void fft_plan::transform(complex_t* data, bool inverse) const
+{
+    for (size_t i = 0; i < half; i++) {
+        if (i < bit_reverse[i]) {
+            swap(data[i], data[bit_reverse[i]]);
+        }
+    }
+
+    for (size_t len = 2; len <= half; len *= 2) {
+        size_t span = len / 2;
+        const complex_t* stage_twiddles = &twiddles[span - 1];
+        for (size_t start = 0; start < half; start += len) {
+            for (size_t j = 0; j < span; j++) {
+                complex_t w = inverse ? conj(stage_twiddles[j]) : stage_twiddles[j];
+                complex_t a = data[start + j];
+                complex_t b = multiply(data[start + j + span], w);
+                data[start + j] = a + b;
+                data[start + j + span] = a - b;
+            }
+        }
+    }
+}
+
+void fft_plan::forward_real(const double* in, complex_t* out) const
+{
+    for (size_t i = 0; i < half; i++) {
+        out[i] = complex_t(in[2 * i], in[2 * i + 1]);
+    }
+
+    transform(out, false);
+
+    // Split the packed spectrum, two mirrored bins at a time so that it can
+    // be done in place.
+    complex_t z0 = out[0];
+    out[0] = complex_t(z0.real() + z0.imag(), 0.0);
+    out[half] = complex_t(z0.real() - z0.imag(), 0.0);
+
+    const complex_t minus_half_i(0.0, -0.5);
+    for (size_t k = 1; k <= half / 2; k++) {
+        complex_t a = out[k], b = out[half - k];
+        complex_t even_k = 0.5 * (a + conj(b)), odd_k = multiply(minus_half_i, a - conj(b));
+        complex_t even_m = 0.5 * (b + conj(a)), odd_m = multiply(minus_half_i, b - conj(a));
+
+        out[k] = even_k + multiply(real_twiddles[k], odd_k);
+        out[half - k] = even_m + multiply(real_twiddles[half - k], odd_m);
+    }
+}
+
+void fft_plan::inverse_real(complex_t* in, double* out) const
+{
+    // Recombine the even and odd half spectra into one packed spectrum,
+    // again two mirrored bins at a time.
+    const complex_t i_unit(0.0, 1.0);
+    complex_t x0 = in[0], xm = in[half];
+    in[0] = 0.5 * ((x0 + xm) + multiply(i_unit, x0 - xm));
+
+    for (size_t k = 1; k <= half / 2; k++) {
+        complex_t a = in[k], b = in[half - k];
+        complex_t even_k = 0.5 * (a + conj(b)), odd_k = 0.5 * multiply(a - conj(b), conj(real_twiddles[k]));
+        complex_t even_m = 0.5 * (b + conj(a)), odd_m = 0.5 * multiply(b - conj(a), conj(real_twiddles[half - k]));
+
+        in[k] = even_k + multiply(i_unit, odd_k);
+        in[half - k] = even_m + multiply(i_unit, odd_m);
+    }
+
+    transform(in, true);
+
+    double scale = 1.0 / half;
+    for (size_t i = 0; i < half; i++) {
+        out[2 * i] = in[i].real() * scale;
+        out[2 * i + 1] = in[i].imag() * scale;
+    }
+}
+
+const fft_plan& wordalyzer::get_fft_plan(size_t n)
+{
+    static mutex plans_mutex;
+    static map<size_t, unique_ptr<fft_plan>> plans;
+
+    lock_guard<mutex> lock(plans_mutex);
+    unique_ptr<fft_plan>& plan = plans[n];
+    if (!plan) {
+        plan.reset(new fft_plan(n));
+    }
+
+    return *plan;
+}
+
+size_t wordalyzer::next_power_of_two(size_t n)
+{
+    size_t res = 1;
+    while (res < n) {
+        res *= 2;
+    }
+
+    return res;
+}
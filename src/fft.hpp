@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+#include <complex>
+#include <cstddef>
+
+namespace wordalyzer {
+    // A precomputed radix-2 FFT of real input. Plans are immutable once
+    // built, so one plan can be shared between threads.
+    class fft_plan {
+    public:
+        typedef std::complex<double> complex_t;
+
+        // `n` is the length of the real transform and must be a power of two.
+        fft_plan(size_t n);
+
+        size_t get_size() const {
+            return n;
+        }
+
+        // Transforms n real samples into the n/2 + 1 non-redundant bins.
+        // `out` must have room for n/2 + 1 values.
+        void forward_real(const double* in, complex_t* out) const;
+
+        // Inverse of forward_real, including the 1/n normalization. The
+        // n/2 + 1 bins in `in` are overwritten.
+        void inverse_real(complex_t* in, double* out) const;
+
+    private:
+        size_t n, half;
+        std::vector<complex_t> twiddles, real_twiddles;
+        std::vector<size_t> bit_reverse;
+
+        void transform(complex_t* data, bool inverse) const;
+    };
+
+    // Returns a plan for real transforms of length n, building it on first
+    // use. Plans are cached for the lifetime of the program.
+    const fft_plan& get_fft_plan(size_t n);
+
+    size_t next_power_of_two(size_t n);
+}
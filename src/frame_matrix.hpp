@@ -0,0 +1,88 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+namespace wordalyzer {
+    // A view of one row of a frame_matrix. Valid as long as the matrix is
+    // not resized.
+    template<typename T>
+    class row_view {
+    private:
+        T* ptr;
+        size_t len;
+
+    public:
+        row_view(T* _ptr, size_t _len) : ptr(_ptr), len(_len) {}
+
+        size_t size() const { return len; }
+        T* data() const { return ptr; }
+        T* begin() const { return ptr; }
+        T* end() const { return ptr + len; }
+
+        T& operator[](size_t i) const { return ptr[i]; }
+    };
+
+    // Per-frame feature vectors stored row-major in a single allocation:
+    // row i holds the `order` values of frame i and starts at i * stride.
+    template<typename T>
+    class frame_matrix {
+    private:
+        std::vector<T> values;
+        size_t frames, order, stride;
+
+    public:
+        frame_matrix() : frames(0), order(0), stride(0) {}
+
+        frame_matrix(size_t _frames, size_t _order) :
+            values(_frames * _order), frames(_frames), order(_order), stride(_order) {}
+
+        frame_matrix(size_t _frames, size_t _order, size_t _stride) :
+            values(_frames * _stride), frames(_frames), order(_order), stride(_stride) {}
+
+        size_t get_frames() const { return frames; }
+        size_t get_order() const { return order; }
+        size_t get_stride() const { return stride; }
+        bool empty() const { return frames == 0; }
+
+        // True if the rows follow each other without padding, so the whole
+        // matrix can be copied at once.
+        bool is_contiguous() const { return stride == order; }
+
+        T* data() { return values.data(); }
+        const T* data() const { return values.data(); }
+
+        row_view<T> row(size_t i) { return row_view<T>(values.data() + i * stride, order); }
+        row_view<const T> row(size_t i) const { return row_view<const T>(values.data() + i * stride, order); }
+
+        void resize(size_t new_frames, size_t new_order)
+        {
+            values.assign(new_frames * new_order, T());
+            frames = new_frames;
+            order = new_order;
+            stride = new_order;
+        }
+    };
+
+    // A read-only view of rows of `order` values stored one after another
+    // elsewhere. Valid as long as that storage is.
+    template<typename T>
+    class frame_matrix_view {
+    private:
+        const T* values;
+        size_t frames, order;
+
+    public:
+        frame_matrix_view() : values(nullptr), frames(0), order(0) {}
+
+        frame_matrix_view(const T* _values, size_t _frames, size_t _order) :
+            values(_values), frames(_frames), order(_order) {}
+
+        size_t get_frames() const { return frames; }
+        size_t get_order() const { return order; }
+        bool empty() const { return frames == 0; }
+
+        const T* data() const { return values; }
+
+        row_view<const T> row(size_t i) const { return row_view<const T>(values + i * order, order); }
+    };
+}
@@ -0,0 +1,473 @@
+#include "ingest.hpp"
+#include "endpointing.hpp"
+#include "resample.hpp"
+#include <algorithm>
+#include <memory>
+
+using namespace wordalyzer;
+using namespace std;
+
+namespace wordalyzer {
+    // Samples are fed to the endpointer in blocks of this many. A word is
+    // finalized a fixed delay after it ends, so with small blocks it is
+    // analyzed while the endpointer's reads have left it in cache.
+    const size_t INGEST_BLOCK_SAMPLES = 4096;
+
+    template<typename Source>
+    vector<word_t> analyze_blocks(Source& source,
+                                  vector<pair<int, int>>& endpoints,
+                                  int window_size,
+                                  int window_stride,
+                                  int vector_size,
+                                  WindowFunction window_fn,
+                                  LpcSolver solver,
+                                  int thread_count,
+                                  Precision precision,
+                                  int sample_rate);
+
+    // Returns a resampler from the input rate to the analysis rate, or
+    // none if words are analyzed at the input rate
+    unique_ptr<resampler> make_word_resampler(int input_rate, int sample_rate);
+
+    // The first input sample read by a word that starts at `start`, in
+    // output samples when words are resampled
+    size_t get_first_word_input(const resampler* r, size_t start);
+
+    // Resamples the word at `word`, in output samples, from the input
+    // samples at `input`, which start at input sample `input_first`, and
+    // analyzes it. `samples` is reused between words.
+    word_t analyze_resampled_word(resampler& r,
+                                  const float* input,
+                                  int64_t input_first,
+                                  size_t input_count,
+                                  pair<int, int> word,
+                                  vector<float>& samples,
+                                  int window_size,
+                                  int window_stride,
+                                  int vector_size,
+                                  WindowFunction window_fn,
+                                  LpcSolver solver,
+                                  int thread_count,
+                                  Precision precision);
+
+    // Analyzes the word of `audio` at `word`, in input samples, adding its
+    // endpoints at the analysis rate to `endpoints`
+    word_t analyze_audio_word(const audio_t& audio,
+                              resampler* r,
+                              pair<int, int> word,
+                              vector<pair<int, int>>& endpoints,
+                              vector<float>& samples,
+                              int window_size,
+                              int window_stride,
+                              int vector_size,
+                              WindowFunction window_fn,
+                              LpcSolver solver,
+                              int thread_count,
+                              Precision precision);
+
+    // Analyzes the words of `wav` at `words`, in input samples, reading
+    // only the samples of each
+    vector<word_t> analyze_mapped_words(const mapped_wav_file& wav,
+                                        const vector<pair<int, int>>& words,
+                                        vector<pair<int, int>>& endpoints,
+                                        int window_size,
+                                        int window_stride,
+                                        int vector_size,
+                                        WindowFunction window_fn,
+                                        LpcSolver solver,
+                                        int thread_count,
+                                        Precision precision,
+                                        int sample_rate);
+}
+
+unique_ptr<resampler> wordalyzer::make_word_resampler(int input_rate, int sample_rate)
+{
+    if (sample_rate == 0 || sample_rate == input_rate) {
+        return nullptr;
+    }
+
+    return unique_ptr<resampler>(new resampler(input_rate, sample_rate));
+}
+
+size_t wordalyzer::get_first_word_input(const resampler* r, size_t start)
+{
+    if (r == nullptr) {
+        return start;
+    }
+
+    int64_t input_begin, input_end;
+    r->get_input_range(start, 1, input_begin, input_end);
+    return max<int64_t>(input_begin, 0);
+}
+
+word_t wordalyzer::analyze_resampled_word(resampler& r,
+                                          const float* input,
+                                          int64_t input_first,
+                                          size_t input_count,
+                                          pair<int, int> word,
+                                          vector<float>& samples,
+                                          int window_size,
+                                          int window_stride,
+                                          int vector_size,
+                                          WindowFunction window_fn,
+                                          LpcSolver solver,
+                                          int thread_count,
+                                          Precision precision)
+{
+    // The last frames read past the end of the word, so those samples are
+    // resampled as well
+    size_t length = max(word.second - word.first, 0);
+    samples.resize(get_word_extent(length, window_size, window_stride));
+    r.resample(input, input_first, input_count, word.first, samples.size(), samples.data());
+
+    return analyze_word(samples.begin(),
+                        samples.begin() + length,
+                        window_size,
+                        window_stride,
+                        vector_size,
+                        window_fn,
+                        solver,
+                        thread_count,
+                        precision);
+}
+
+word_t wordalyzer::analyze_audio_word(const audio_t& audio,
+                                      resampler* r,
+                                      pair<int, int> word,
+                                      vector<pair<int, int>>& endpoints,
+                                      vector<float>& samples,
+                                      int window_size,
+                                      int window_stride,
+                                      int vector_size,
+                                      WindowFunction window_fn,
+                                      LpcSolver solver,
+                                      int thread_count,
+                                      Precision precision)
+{
+    if (r) {
+        word = make_pair(r->get_output_index(word.first), r->get_output_index(word.second));
+        endpoints.push_back(word);
+        return analyze_resampled_word(*r,
+                                      audio.samples.data(),
+                                      0,
+                                      audio.samples.size(),
+                                      word,
+                                      samples,
+                                      window_size,
+                                      window_stride,
+                                      vector_size,
+                                      window_fn,
+                                      solver,
+                                      thread_count,
+                                      precision);
+    }
+
+    // The last frames read past the end of the word, and samples past the
+    // end of the audio read as silence
+    endpoints.push_back(word);
+    size_t length = max(word.second - word.first, 0);
+    size_t extent = get_word_extent(length, window_size, window_stride);
+    size_t available = min(extent, audio.samples.size() - word.first);
+    samples.assign(extent, 0.0f);
+    copy(audio.samples.begin() + word.first, audio.samples.begin() + word.first + available, samples.begin());
+
+    return analyze_word(samples.begin(),
+                        samples.begin() + length,
+                        window_size,
+                        window_stride,
+                        vector_size,
+                        window_fn,
+                        solver,
+                        thread_count,
+                        precision);
+}
+
+vector<word_t> wordalyzer::analyze_audio(const audio_t& audio,
+                                         vector<pair<int, int>>& endpoints,
+                                         int window_size,
+                                         int window_stride,
+                                         int vector_size,
+                                         WindowFunction window_fn,
+                                         LpcSolver solver,
+                                         int thread_count,
+                                         Precision precision,
+                                         int sample_rate)
+{
+    endpoints.clear();
+
+    unique_ptr<resampler> r = make_word_resampler(audio.sample_rate, sample_rate);
+    vector<float> word_samples;
+    vector<word_t> res;
+
+    // Inputs long enough to split between threads are endpointed as a
+    // whole first, giving up the single pass
+    if (get_endpointing_threads(audio.samples.size(), audio.sample_rate, thread_count) > 1) {
+        for (auto p : compute_endpoints(audio, thread_count)) {
+            res.push_back(analyze_audio_word(audio, r.get(), p, endpoints, word_samples, window_size, window_stride,
+                                             vector_size, window_fn, solver, thread_count, precision));
+        }
+
+        return res;
+    }
+
+    endpointer ep(audio.sample_rate);
+    size_t i = 0;
+    bool finished = false;
+    while (!finished) {
+        if (i < audio.samples.size()) {
+            size_t n = min(INGEST_BLOCK_SAMPLES, audio.samples.size() - i);
+            ep.push_samples(&audio.samples[i], n);
+            i += n;
+        } else {
+            ep.finish();
+            finished = true;
+        }
+
+        for (auto p : ep.take_words()) {
+            res.push_back(analyze_audio_word(audio, r.get(), p, endpoints, word_samples, window_size, window_stride,
+                                             vector_size, window_fn, solver, thread_count, precision));
+        }
+    }
+
+    return res;
+}
+
+vector<word_t> wordalyzer::analyze_mapped_words(const mapped_wav_file& wav,
+                                                const vector<pair<int, int>>& words,
+                                                vector<pair<int, int>>& endpoints,
+                                                int window_size,
+                                                int window_stride,
+                                                int vector_size,
+                                                WindowFunction window_fn,
+                                                LpcSolver solver,
+                                                int thread_count,
+                                                Precision precision,
+                                                int sample_rate)
+{
+    unique_ptr<resampler> r = make_word_resampler(wav.get_sample_rate(), sample_rate);
+    vector<float> input, word_samples;
+
+    // Samples past the end of the file read as silence, as they do when
+    // the file is streamed
+    vector<word_t> res;
+    for (auto p : words) {
+        if (r) {
+            p = make_pair(r->get_output_index(p.first), r->get_output_index(p.second));
+        }
+
+        size_t length = max(p.second - p.first, 0);
+        size_t extent = get_word_extent(length, window_size, window_stride);
+
+        endpoints.push_back(p);
+        if (r) {
+            int64_t input_begin, input_end;
+            r->get_input_range(p.first, extent, input_begin, input_end);
+            input_begin = max<int64_t>(input_begin, 0);
+            input.resize(max<int64_t>(input_end - input_begin, 0));
+            wav.read_samples(input_begin, input.size(), input.data());
+
+            res.push_back(analyze_resampled_word(*r,
+                                                 input.data(),
+                                                 input_begin,
+                                                 input.size(),
+                                                 p,
+                                                 word_samples,
+                                                 window_size,
+                                                 window_stride,
+                                                 vector_size,
+                                                 window_fn,
+                                                 solver,
+                                                 thread_count,
+                                                 precision));
+            continue;
+        }
+
+        input.resize(extent);
+        wav.read_samples(p.first, extent, input.data());
+        res.push_back(analyze_word(input.begin(),
+                                   input.begin() + length,
+                                   window_size,
+                                   window_stride,
+                                   vector_size,
+                                   window_fn,
+                                   solver,
+                                   thread_count,
+                                   precision));
+    }
+
+    return res;
+}
+
+template<typename Source>
+vector<word_t> wordalyzer::analyze_blocks(Source& source,
+                                          vector<pair<int, int>>& endpoints,
+                                          int window_size,
+                                          int window_stride,
+                                          int vector_size,
+                                          WindowFunction window_fn,
+                                          LpcSolver solver,
+                                          int thread_count,
+                                          Precision precision,
+                                          int sample_rate)
+{
+    endpointer ep(source.get_sample_rate());
+    endpoints.clear();
+
+    unique_ptr<resampler> r = make_word_resampler(source.get_sample_rate(), sample_rate);
+    vector<float> word_samples;
+
+    // The samples from `history_start` on. Words are analyzed straight
+    // from here, so it has to reach back to the start of the earliest
+    // word that is still to be analyzed. Pending words are in output
+    // samples when they are resampled.
+    vector<float> history;
+    size_t history_start = 0;
+    vector<pair<int, int>> pending;
+
+    vector<word_t> res;
+    bool finished = false;
+    while (!finished) {
+        size_t old_size = history.size();
+        history.resize(old_size + INGEST_BLOCK_SAMPLES);
+        size_t n = source.next_block(&history[old_size], INGEST_BLOCK_SAMPLES);
+        history.resize(old_size + n);
+
+        if (n > 0) {
+            ep.push_samples(&history[old_size], n);
+        } else {
+            ep.finish();
+            finished = true;
+        }
+
+        for (auto p : ep.take_words()) {
+            if (r) {
+                p = make_pair(r->get_output_index(p.first), r->get_output_index(p.second));
+            }
+            pending.push_back(p);
+        }
+
+        // The last frames of a word read past its end, so a word waits
+        // until those samples are in as well
+        size_t done = 0;
+        for (; done < pending.size(); done++) {
+            auto p = pending[done];
+            size_t length = max(p.second - p.first, 0);
+            size_t extent = get_word_extent(length, window_size, window_stride);
+
+            int64_t input_end = p.first + extent;
+            if (r) {
+                int64_t input_begin;
+                r->get_input_range(p.first, extent, input_begin, input_end);
+            }
+
+            if (input_end > static_cast<int64_t>(history_start + history.size())) {
+                if (!finished) {
+                    break;
+                }
+
+                // Frames past the end of the input read silence, which the
+                // resampler already reads there
+                if (!r) {
+                    history.resize(input_end - history_start, 0.0f);
+                }
+            }
+
+            endpoints.push_back(p);
+            if (r) {
+                res.push_back(analyze_resampled_word(*r,
+                                                     history.data(),
+                                                     history_start,
+                                                     history.size(),
+                                                     p,
+                                                     word_samples,
+                                                     window_size,
+                                                     window_stride,
+                                                     vector_size,
+                                                     window_fn,
+                                                     solver,
+                                                     thread_count,
+                                                     precision));
+                continue;
+            }
+
+            auto begin = history.begin() + (p.first - history_start);
+            res.push_back(analyze_word(begin,
+                                       begin + length,
+                                       window_size,
+                                       window_stride,
+                                       vector_size,
+                                       window_fn,
+                                       solver,
+                                       thread_count,
+                                       precision));
+        }
+        pending.erase(pending.begin(), pending.begin() + done);
+
+        // Samples that no word can use anymore are dropped once they make
+        // up half of the history, so that each sample is moved at most
+        // about once.
+        size_t earliest_start = ep.get_earliest_word_start();
+        if (r) {
+            earliest_start = r->get_output_index(earliest_start);
+        }
+
+        if (!pending.empty()) {
+            earliest_start = min(earliest_start, static_cast<size_t>(pending.front().first));
+        }
+
+        size_t keep_from = get_first_word_input(r.get(), earliest_start);
+
+        size_t drop = keep_from > history_start ? min(keep_from - history_start, history.size()) : 0;
+        if (drop > 0 && drop >= history.size() / 2) {
+            history.erase(history.begin(), history.begin() + drop);
+            history_start += drop;
+        }
+    }
+
+    return res;
+}
+
+vector<word_t> wordalyzer::analyze_wav(mapped_wav_file& wav,
+                                       vector<pair<int, int>>& endpoints,
+                                       int window_size,
+                                       int window_stride,
+                                       int vector_size,
+                                       WindowFunction window_fn,
+                                       LpcSolver solver,
+                                       int thread_count,
+                                       Precision precision,
+                                       int sample_rate)
+{
+    // The file can be read anywhere, so long ones are endpointed by
+    // several threads first
+    if (get_endpointing_threads(wav.get_total_samples(), wav.get_sample_rate(), thread_count) > 1) {
+        endpoints.clear();
+        return analyze_mapped_words(wav,
+                                    compute_endpoints(wav, thread_count),
+                                    endpoints,
+                                    window_size,
+                                    window_stride,
+                                    vector_size,
+                                    window_fn,
+                                    solver,
+                                    thread_count,
+                                    precision,
+                                    sample_rate);
+    }
+
+    return analyze_blocks(wav, endpoints, window_size, window_stride, vector_size, window_fn, solver, thread_count, precision, sample_rate);
+}
+
+vector<word_t> wordalyzer::analyze_wav(wav_file& wav,
+                                       vector<pair<int, int>>& endpoints,
+                                       int window_size,
+                                       int window_stride,
+                                       int vector_size,
+                                       WindowFunction window_fn,
+                                       LpcSolver solver,
+                                       int thread_count,
+                                       Precision precision,
+                                       int sample_rate)
+{
+    return analyze_blocks(wav, endpoints, window_size, window_stride, vector_size, window_fn, solver, thread_count, precision, sample_rate);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+
+#include "audio.hpp"
+#include "lpc.hpp"
+#include "wav.hpp"
+
+namespace wordalyzer {
+    // Finds the words in `audio` and analyzes each of them, in a single
+    // pass over the samples. Words are analyzed as soon as the endpointer
+    // finalizes them, while their samples are still in cache, rather than
+    // after the whole input has been endpointed. Writes the endpoints of
+    // the words to `endpoints`; the result is the same as running
+    // compute_endpoints() and then analyze_word() on every word.
+    //
+    // An input long enough for compute_endpoints() to split between more
+    // than one of `thread_count` threads is endpointed that way instead,
+    // as a whole, before its words are analyzed.
+    //
+    // Unless `sample_rate` is 0 or the rate of the input, words are
+    // analyzed at `sample_rate` instead: the input is still endpointed at
+    // its own rate, and only the samples of each word are resampled before
+    // it is analyzed. Endpoints are then given at `sample_rate`.
+    std::vector<word_t> analyze_audio(const audio_t& audio,
+                                      std::vector<std::pair<int, int>>& endpoints,
+                                      int window_size,
+                                      int window_stride,
+                                      int vector_size,
+                                      WindowFunction window_fn,
+                                      LpcSolver solver = SOLVER_LEVINSON,
+                                      int thread_count = 1,
+                                      Precision precision = PRECISION_DOUBLE,
+                                      int sample_rate = 0);
+
+    // Same as analyze_audio(), reading the samples from a WAV file a block
+    // at a time. Samples are only kept for as long as a word may still
+    // need them, so memory does not grow with the length of the file.
+    // Mapped files long enough to endpoint with several threads are
+    // endpointed in parallel first, each thread converting its own range,
+    // and then only the samples of each word are read. Files read from a
+    // stream are always endpointed by a single thread.
+    std::vector<word_t> analyze_wav(mapped_wav_file& wav,
+                                    std::vector<std::pair<int, int>>& endpoints,
+                                    int window_size,
+                                    int window_stride,
+                                    int vector_size,
+                                    WindowFunction window_fn,
+                                    LpcSolver solver = SOLVER_LEVINSON,
+                                    int thread_count = 1,
+                                    Precision precision = PRECISION_DOUBLE,
+                                    int sample_rate = 0);
+    std::vector<word_t> analyze_wav(wav_file& wav,
+                                    std::vector<std::pair<int, int>>& endpoints,
+                                    int window_size,
+                                    int window_stride,
+                                    int vector_size,
+                                    WindowFunction window_fn,
+                                    LpcSolver solver = SOLVER_LEVINSON,
+                                    int thread_count = 1,
+                                    Precision precision = PRECISION_DOUBLE,
+                                    int sample_rate = 0);
+}
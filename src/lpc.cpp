@@ -1,31 +1,147 @@
 #include <armadillo>
+#include <algorithm>
+#include <cassert>
+#include <thread>
+#include <type_traits>
 #include "lpc.hpp"
+#include "allocation_counter.hpp"
 
 using namespace wordalyzer;
 using namespace std;
 
 namespace wordalyzer {
-    vector<double> analyze_window(const vector<float>& samples, int p);
-    double autocorrelate(const vector<float>& samples, int k);
+    typedef void (*fixed_order_kernel)(lpc_workspace_t& workspace, double* coeffs);
+
+    struct fixed_order_t {
+        int order;
+        fixed_order_kernel kernel;
+    };
+
+    template<typename Order>
+    double levinson_durbin_impl(const double* R, Order p, double* coeffs, double* reflection);
+
+    template<int P>
+    void analyze_window_fixed(lpc_workspace_t& workspace, double* coeffs);
+    fixed_order_kernel get_fixed_order_kernel(int p);
+
+    void analyze_window(lpc_workspace_t& workspace,
+                        int p,
+                        LpcSolver solver,
+                        AutocorrelationMethod method,
+                        double* coeffs);
+    void solve_armadillo(const double* R, int p, double* coeffs);
+    void solve_lpc(const double* R, int p, LpcSolver solver, double* coeffs);
+    size_t get_frame_count(size_t word_samples, int window_size, int window_stride);
+    bool use_sliding_autocorrelation(int window_size, int window_stride, int vector_size, WindowFunction window_fn);
+    void analyze_frames(vector<float>::const_iterator begin,
+                        size_t first_frame,
+                        size_t last_frame,
+                        int window_size,
+                        int window_stride,
+                        int vector_size,
+                        WindowFunction window_fn,
+                        LpcSolver solver,
+                        AutocorrelationMethod method,
+                        word_t& res);
+
+    // With sliding autocorrelation, R is recomputed from scratch on every
+    // frame whose index is a multiple of this, to bound the drift.
+    const size_t SLIDING_REFRESH_FRAMES = 16;
+
+    // Sliding autocorrelation is used for strides of at most this fraction
+    // of the window size.
+    const int SLIDING_MAX_STRIDE_FRACTION = 4;
+
+    // Orders used in practice get their own kernels, with the order known at
+    // compile time. The autocorrelation side is instantiated for the same
+    // orders in autocorrelation.cpp.
+    const fixed_order_t FIXED_ORDER_KERNELS[] = {
+        { 10, analyze_window_fixed<10> },
+        { 12, analyze_window_fixed<12> },
+        { 16, analyze_window_fixed<16> },
+        { 24, analyze_window_fixed<24> }
+    };
 }
 
-double wordalyzer::autocorrelate(const vector<float>& samples, int k)
+wordalyzer::lpc_workspace_t::lpc_workspace_t(int window_size, int vector_size) :
+    window(window_size), R(vector_size + 1), coeffs(vector_size)
 {
-    double res = 0.0;
-    for (size_t i = k; i < samples.size(); i++) {
-        res += static_cast<double>(samples[i]) * static_cast<double>(samples[i - k]);
+    reserve_autocorrelation_scratch(autocorrelation, window_size, vector_size);
+}
+
+// `Order` is either int or an std::integral_constant, in which case every
+// loop bound is a compile-time constant and the loops can be unrolled.
+template<typename Order>
+inline double wordalyzer::levinson_durbin_impl(const double* R, Order p, double* coeffs, double* reflection)
+{
+    for (int i = 0; i < p; i++) {
+        coeffs[i] = 0.0;
+        if (reflection != nullptr) {
+            reflection[i] = 0.0;
+        }
     }
 
-    return res;
+    double error = R[0];
+    for (int i = 0; i < p; i++) {
+        // A silent or degenerate window leaves nothing more to predict, so
+        // the remaining coefficients stay zero.
+        if (error <= 0.0) {
+            break;
+        }
+
+        double acc = R[i + 1];
+        for (int j = 0; j < i; j++) {
+            acc -= coeffs[j] * R[i - j];
+        }
+
+        double k = acc / error;
+        if (reflection != nullptr) {
+            reflection[i] = k;
+        }
+
+        // Update coefficients 0..i-1 in place, pairing each one with its
+        // mirror image so no temporary copy is needed.
+        for (int j = 0, l = i - 1; j <= l; j++, l--) {
+            double a_j = coeffs[j], a_l = coeffs[l];
+            coeffs[j] = a_j - k * a_l;
+            if (j != l) {
+                coeffs[l] = a_l - k * a_j;
+            }
+        }
+        coeffs[i] = k;
+
+        error *= 1.0 - k * k;
+    }
+
+    return error;
+}
+
+double wordalyzer::levinson_durbin(const double* R, int p, double* coeffs, double* reflection)
+{
+    return levinson_durbin_impl(R, p, coeffs, reflection);
 }
 
-vector<double> wordalyzer::analyze_window(const vector<float>& samples, int p)
+template<int P>
+void wordalyzer::analyze_window_fixed(lpc_workspace_t& workspace, double* coeffs)
 {
-    vector<double> R(p + 1);
-    for (int i = 0; i <= p; i++) {
-        R[i] = autocorrelate(samples, i);
+    double R[P + 1];
+    autocorrelate_fixed<P>(&workspace.window[0], workspace.window.size(), R, workspace.autocorrelation);
+    levinson_durbin_impl(R, integral_constant<int, P>(), coeffs, nullptr);
+}
+
+fixed_order_kernel wordalyzer::get_fixed_order_kernel(int p)
+{
+    for (const auto& fixed : FIXED_ORDER_KERNELS) {
+        if (fixed.order == p) {
+            return fixed.kernel;
+        }
     }
 
+    return nullptr;
+}
+
+void wordalyzer::solve_armadillo(const double* R, int p, double* coeffs)
+{
     arma::mat M(p, p);
 
     // Fill the matrix
@@ -49,14 +165,141 @@ vector<double> wordalyzer::analyze_window(const vector<float>& samples, int p)
         v(i, 0) = R[i + 1];
     }
 
-    arma::mat coeffs = arma::inv(M) * v;
+    arma::mat res = arma::inv(M) * v;
 
-    vector<double> res(p);
     for (int i = 0; i < p; i++) {
-        res[i] = coeffs(i, 0);
+        coeffs[i] = res(i, 0);
     }
+}
 
-    return res;
+void wordalyzer::analyze_window(lpc_workspace_t& workspace,
+                                int p,
+                                LpcSolver solver,
+                                AutocorrelationMethod method,
+                                double* coeffs)
+{
+    const float* samples = &workspace.window[0];
+    size_t n = workspace.window.size();
+    double* R = &workspace.R[0];
+
+    switch (method) {
+    case AUTOCORRELATION_FFT: autocorrelate_fft(samples, n, p, R, workspace.autocorrelation); break;
+    case AUTOCORRELATION_DIRECT:
+    default: autocorrelate(samples, n, p, R, workspace.autocorrelation); break;
+    }
+
+    solve_lpc(R, p, solver, coeffs);
+}
+
+void wordalyzer::solve_lpc(const double* R, int p, LpcSolver solver, double* coeffs)
+{
+    switch (solver) {
+    case SOLVER_ARMADILLO: solve_armadillo(R, p, coeffs); break;
+    case SOLVER_LEVINSON:
+    default: levinson_durbin(R, p, coeffs, nullptr); break;
+    }
+}
+
+size_t wordalyzer::get_frame_count(size_t word_samples, int window_size, int window_stride)
+{
+    // Windows are centered at begin + window_size / 2 + k * window_stride,
+    // for every center before the end of the word.
+    if (word_samples <= static_cast<size_t>(window_size / 2)) {
+        return 0;
+    }
+
+    return (word_samples - window_size / 2 - 1) / window_stride + 1;
+}
+
+bool wordalyzer::use_sliding_autocorrelation(int window_size, int window_stride, int vector_size, WindowFunction window_fn)
+{
+    // Only a rectangular window leaves the samples shared by consecutive
+    // frames unchanged. Sliding touches 2 * stride samples per lag instead
+    // of window_size, so it only pays off for strides well below that.
+    return window_fn == WINDOW_NONE &&
+           window_stride + vector_size < window_size &&
+           window_stride * SLIDING_MAX_STRIDE_FRACTION <= window_size;
+}
+
+void wordalyzer::analyze_frames(vector<float>::const_iterator begin,
+                                size_t first_frame,
+                                size_t last_frame,
+                                int window_size,
+                                int window_stride,
+                                int vector_size,
+                                WindowFunction window_fn,
+                                LpcSolver solver,
+                                AutocorrelationMethod method,
+                                word_t& res)
+{
+    const vector<float>& table = get_window_table(window_fn, window_size);
+    lpc_workspace_t workspace(window_size, vector_size);
+
+    // The fixed-order kernels implement direct autocorrelation followed by
+    // Levinson-Durbin, so they only replace that combination.
+    fixed_order_kernel fixed_kernel = nullptr;
+    if (solver == SOLVER_LEVINSON && method == AUTOCORRELATION_DIRECT) {
+        fixed_kernel = get_fixed_order_kernel(vector_size);
+    }
+
+    bool sliding = use_sliding_autocorrelation(window_size, window_stride, vector_size, window_fn);
+
+    // Single-precision words are analyzed in double like the others, their
+    // coefficients are only rounded when they are stored.
+    bool single = res.precision == PRECISION_SINGLE;
+
+    for (size_t frame = first_frame; frame < last_frame; frame++) {
+#ifndef NDEBUG
+        size_t allocations = get_thread_allocation_count();
+#endif
+
+        const float* samples = &*(begin + frame * window_stride);
+        double* coeffs = single ? workspace.coeffs.data() : res.coeffs.row(frame).data();
+        if (sliding) {
+            // Refreshes happen at fixed frame indices rather than relative
+            // to first_frame, so the result does not depend on how frames
+            // are split between workers.
+            double* R = &workspace.R[0];
+            if (frame == first_frame || frame % SLIDING_REFRESH_FRAMES == 0) {
+                if (method == AUTOCORRELATION_FFT) {
+                    autocorrelate_fft(samples, window_size, vector_size, R, workspace.autocorrelation);
+                } else {
+                    autocorrelate(samples, window_size, vector_size, R, workspace.autocorrelation);
+                }
+            } else {
+                slide_autocorrelation(samples - window_stride, window_size, window_stride, vector_size, R);
+            }
+
+            solve_lpc(R, vector_size, solver, coeffs);
+        } else if (fixed_kernel != nullptr) {
+            apply_window_table(samples, table, &workspace.window[0]);
+            fixed_kernel(workspace, coeffs);
+        } else {
+            apply_window_table(samples, table, &workspace.window[0]);
+            analyze_window(workspace, vector_size, solver, method, coeffs);
+        }
+
+        if (single) {
+            copy(coeffs, coeffs + vector_size, res.single_coeffs.row(frame).begin());
+        }
+
+        // The Armadillo solver allocates its matrices, everything else must
+        // run out of the workspace.
+#ifndef NDEBUG
+        assert((solver == SOLVER_ARMADILLO || get_thread_allocation_count() == allocations) &&
+               "Frame analysis allocated memory");
+#endif
+    }
+}
+
+size_t wordalyzer::get_word_extent(size_t word_samples, int window_size, int window_stride)
+{
+    size_t frame_count = get_frame_count(word_samples, window_size, window_stride);
+    if (frame_count == 0) {
+        return word_samples;
+    }
+
+    return max(word_samples, (frame_count - 1) * window_stride + window_size);
 }
 
 word_t wordalyzer::analyze_word(std::vector<float>::const_iterator begin,
@@ -64,22 +307,61 @@ word_t wordalyzer::analyze_word(std::vector<float>::const_iterator begin,
                                 int window_size,
                                 int window_stride,
                                 int vector_size,
-                                WindowFunction window_fn)
+                                WindowFunction window_fn,
+                                LpcSolver solver,
+                                int thread_count,
+                                Precision precision)
 {
-    vector<float> window(window_size);
+    size_t frame_count = 0;
+    if (end > begin) {
+        frame_count = get_frame_count(end - begin, window_size, window_stride);
+    }
+
+    AutocorrelationMethod method = choose_autocorrelation_method(window_size, vector_size);
     word_t res;
-    for (auto it = begin + window_size / 2; it < end; it += window_stride) {
-        for (int i = 0; i < window_size; i++) {
-            window[i] = *(it + i - window_size / 2);
-        }
-        apply_window(window_fn, window);
-        for (int i = 0; i < window_size; i++) {
-            window[i] *= 1.0f / get_window_gain(window_fn);
-        }
+    res.precision = precision;
+    if (precision == PRECISION_SINGLE) {
+        res.single_coeffs.resize(frame_count, vector_size);
+    } else {
+        res.coeffs.resize(frame_count, vector_size);
+    }
+
+    // Frames are independent, so each worker gets a contiguous range and
+    // writes straight into its own slots of the result. With sliding
+    // autocorrelation, ranges start on refresh frames so that every frame
+    // is computed exactly as in a serial run.
+    size_t granularity = 1;
+    if (use_sliding_autocorrelation(window_size, window_stride, vector_size, window_fn)) {
+        granularity = SLIDING_REFRESH_FRAMES;
+    }
 
-        res.coeff_vectors.push_back(analyze_window(window, vector_size));
+    size_t chunks = (frame_count + granularity - 1) / granularity;
+    size_t workers = min<size_t>(max(thread_count, 1), chunks);
+    if (workers <= 1) {
+        analyze_frames(begin, 0, frame_count, window_size, window_stride, vector_size, window_fn, solver, method, res);
+        return res;
+    }
+
+    vector<thread> threads;
+    for (size_t w = 0; w < workers; w++) {
+        size_t first_frame = chunks * w / workers * granularity;
+        size_t last_frame = min(chunks * (w + 1) / workers * granularity, frame_count);
+        threads.emplace_back(analyze_frames,
+                             begin,
+                             first_frame,
+                             last_frame,
+                             window_size,
+                             window_stride,
+                             vector_size,
+                             window_fn,
+                             solver,
+                             method,
+                             ref(res));
+    }
+
+    for (auto& t : threads) {
+        t.join();
     }
 
     return res;
 }
-
@@ -3,12 +3,48 @@
 
 #include "audio.hpp"
 #include "window.hpp"
+#include "autocorrelation.hpp"
 
 namespace wordalyzer {
+    enum LpcSolver {
+        SOLVER_LEVINSON,
+        SOLVER_ARMADILLO
+    };
+
+    // Buffers for analyzing frames of a given size and order. A workspace
+    // is owned by a single thread and reused for every frame it analyzes,
+    // so that analysis does not touch the heap once it is constructed.
+    struct lpc_workspace_t {
+        std::vector<float> window;
+        std::vector<double> R;
+
+        // Coefficients of the current frame, before they are rounded into a
+        // single-precision word
+        std::vector<double> coeffs;
+        autocorrelation_scratch_t autocorrelation;
+
+        lpc_workspace_t(int window_size, int vector_size);
+    };
+
+    // Solves the autocorrelation normal equations for p predictor
+    // coefficients using the Levinson-Durbin recursion, given R[0..p].
+    // Writes p coefficients to `coeffs` and, if `reflection` is not null,
+    // p reflection coefficients to `reflection`. Returns the final
+    // prediction error. Does not allocate.
+    double levinson_durbin(const double* R, int p, double* coeffs, double* reflection);
+
+    // Returns the number of samples from the start of a word of
+    // `word_samples` samples that analyze_word() reads. The last frames
+    // extend past the end of the word.
+    size_t get_word_extent(size_t word_samples, int window_size, int window_stride);
+
     word_t analyze_word(std::vector<float>::const_iterator begin,
                         std::vector<float>::const_iterator end,
                         int window_size,
                         int window_stride,
                         int vector_size,
-                        WindowFunction window_fn);
+                        WindowFunction window_fn,
+                        LpcSolver solver = SOLVER_LEVINSON,
+                        int thread_count = 1,
+                        Precision precision = PRECISION_DOUBLE);
 }
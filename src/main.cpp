@@ -1,7 +1,10 @@
 #include <iostream>
 #include <string>
+#include <atomic>
 #include <cassert>
 #include <fstream>
+#include <memory>
+#include <thread>
 
 #include "common.hpp"
 #include "wav.hpp"
@@ -9,6 +12,7 @@
 #include "database.hpp"
 #include "record.hpp"
 #include "lpc.hpp"
+#include "ingest.hpp"
 
 #include "gui.hpp"
 #include "diff_diagram.hpp"
@@ -20,6 +24,7 @@ enum CommandType {
     CMD_DB_LIST,
     CMD_DB_ADD,
     CMD_DB_REMOVE,
+    CMD_DB_CHECK,
     CMD_DIFF
 };
 
@@ -37,8 +42,13 @@ string clip_name = "";
 duration_t window_size = { 1024, false };
 duration_t window_stride = { 512, false };
 WindowFunction window_fn = WINDOW_HANN;
+LpcSolver lpc_solver = SOLVER_LEVINSON;
+Precision precision = PRECISION_DOUBLE;
+int thread_count = 1;
 bool source_wav = false;
 string source_filename = "";
+int wav_channel = PCM_DOWNMIX;
+int analysis_rate = 0;
 int vector_size = 16;
 
 // diff
@@ -66,13 +76,17 @@ void print_usage(string program_name)
         "       db remove [db_opts] <name>",
         "           remove a clip from the database",
         "",
+        "       db check [db_opts] [-t <threads>]",
+        "           read every word of every clip and check that it is valid, using a given",
+        "           number of threads (default: 1); other processes may keep adding clips",
+        "",
         "       diff [db_opts] <start_vector_1> <start_vector_2> <count>",
         "           shows a diff between word vectors, given the words to test,",
         "           offsets (in windows) within those words, the number of succeeding",
         "           vectors to test, and shows the diagram in a window",
         "",
         "   <source> is one of:",
-        "       wav=<filename>: use a .wav file as a source",
+        "       wav=<filename>: use a .wav file as a source ('-' reads it from standard input)",
         "       record: record from the microphone",
         "",
         "   <start_vector> is <clip>:<word_index>[:offset]:",
@@ -86,6 +100,17 @@ void print_usage(string program_name)
         "       -w <window_size>: use windows of a given size (default: 1024)",
         "       -s <window_stride>: use a given stride (space between window centers) (default: 512)",
         "       -f <hamming|hann|none>: use a given window function (default: hann)",
+        "       -l <levinson|armadillo>: use a given LPC solver (default: levinson)",
+        "       -t <threads>: endpoint and analyze using a given number of threads (default: 1);",
+        "                     endpointing only uses more than one for long inputs that are not",
+        "                     read from standard input",
+        "       -n <double|single>: store coefficients in a given precision (default: double);",
+        "                           analysis always runs in double, single halves the size of",
+        "                           the stored vectors",
+        "       -c <mix|channel>: analyze the average of all channels of a .wav file, or only",
+        "                         a given zero-based channel (default: mix)",
+        "       -r <rate>: analyze words at a given rate in Hz, e.g. 16000, resampling them",
+        "                  (default: analyze at the rate of the source)",
         "",
         "       (All sizes can be also given with a suffix of 'ms' to interpret them as",
         "        milliseconds instead of samples.)",
@@ -180,34 +205,34 @@ void parse_start_vector(const string& option, string& clip_name, int& word_idx,
 void do_diff()
 {
     database db(db_name);
-    clip_t clip_1 = db.get_clip(diff_clip_1);
-    clip_t clip_2 = db.get_clip(diff_clip_2);
-
-    if (word_idx_1 >= clip_1.words.size()) {
-        throw command_line_exception("Index " + to_string(word_idx_1) + " is out of range for clip `" + diff_clip_1 + "`");
-    }
-
-    if (word_idx_2 >= clip_2.words.size()) {
-        throw command_line_exception("Index " + to_string(word_idx_1) + " is out of range for clip `" + diff_clip_2 + "`");
+    clip_t clip_1 = db.get_clip_info(diff_clip_1);
+    clip_t clip_2 = db.get_clip_info(diff_clip_2);
+
+    // Coefficients from different rates describe different bands. Clips
+    // from before the rate was recorded can only be trusted to the user.
+    if (clip_1.sample_rate != 0 && clip_2.sample_rate != 0 && clip_1.sample_rate != clip_2.sample_rate) {
+        throw command_line_exception("Clips `" + diff_clip_1 + "` and `" + diff_clip_2 + "` were analyzed at different "
+                "sample rates (" + to_string(clip_1.sample_rate) + " Hz and " + to_string(clip_2.sample_rate) + " Hz)");
     }
 
-    word_t& word_1 = clip_1.words[word_idx_1];
-    word_t& word_2 = clip_2.words[word_idx_2];
+    // Only the compared frames of the two words are read. Clips of either
+    // precision are compared in double.
+    word_t word_1 = widen_word(db.get_clip_word(diff_clip_1, word_idx_1, vector_offset_1, vector_count));
+    word_t word_2 = widen_word(db.get_clip_word(diff_clip_2, word_idx_2, vector_offset_2, vector_count));
 
-    if (vector_offset_1 + vector_count > word_1.coeff_vectors.size()) {
+    if (word_1.coeffs.get_frames() < static_cast<size_t>(vector_count)) {
         throw command_line_exception("Offset " + to_string(vector_offset_1) + " and count " + to_string(vector_count) + " are out of "
                 "range for clip `" + diff_clip_1 + "`");
     }
 
-    if (vector_offset_2 + vector_count > word_2.coeff_vectors.size()) {
+    if (word_2.coeffs.get_frames() < static_cast<size_t>(vector_count)) {
         throw command_line_exception("Offset " + to_string(vector_offset_2) + " and count " + to_string(vector_count) + " are out of "
                 "range for clip `" + diff_clip_2 + "`");
     }
 
-    gui::diff_diagram diagram(word_1.coeff_vectors.begin() + vector_offset_1,
-                              word_1.coeff_vectors.begin() + vector_offset_1 + vector_count,
-                              word_2.coeff_vectors.begin() + vector_offset_2,
-                              word_2.coeff_vectors.begin() + vector_offset_2 + vector_count);
+    gui::diff_diagram diagram(word_1.coeffs, 0,
+                              word_2.coeffs, 0,
+                              vector_count);
 
     gui::diagram_window window(&diagram);
     window.start();
@@ -233,35 +258,129 @@ void do_db_remove()
     db.remove_clip(clip_name);
 }
 
+void do_db_check()
+{
+    // The pool only reads, so the schema is created or upgraded first
+    vector<string> clips;
+    {
+        database db(db_name);
+        clips = db.get_all_clip_names();
+    }
+
+    // Each thread borrows a connection for one clip at a time, and checks
+    // that every word has the order of the clip
+    database_pool pool(db_name, thread_count);
+    vector<string> results(clips.size());
+    atomic<size_t> next_clip(0);
+    vector<thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.emplace_back([&] {
+            for (size_t i = next_clip++; i < clips.size(); i = next_clip++) {
+                try {
+                    database_pool::lease db = pool.acquire();
+                    clip_t clip = db->get_clip_info(clips[i]);
+                    database::word_cursor cursor = db->scan_clip_words(clips[i]);
+
+                    size_t words = 0, frames = 0;
+                    while (cursor.next()) {
+                        const word_view_t& word = cursor.get();
+                        if (word.get_frames() > 0 && word.get_order() != static_cast<size_t>(clip.vector_size)) {
+                            throw format_exception("Word " + to_string(cursor.get_index()) + " has vectors of size "
+                                                   + to_string(word.get_order()) + " instead of "
+                                                   + to_string(clip.vector_size));
+                        }
+
+                        words++;
+                        frames += word.get_frames();
+                    }
+
+                    results[i] = "[+] `" + clips[i] + "`: " + to_string(words) + " words, " + to_string(frames) + " vectors";
+                } catch (exception& e) {
+                    results[i] = "[-] `" + clips[i] + "`: " + e.what();
+                }
+            }
+        });
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    for (const auto& result : results) {
+        cout << result << endl;
+    }
+}
+
 void do_db_add()
 {
+    // WAV files are read a block at a time while they are analyzed, from
+    // a mapping unless they come through a pipe. Recordings are kept in
+    // memory.
+    unique_ptr<mapped_wav_file> wav;
+    unique_ptr<wav_file> wav_stream;
     audio_t audio;
-    if (source_wav) {
-        std::ifstream wf(source_filename);
-        audio = audio_from_wav(wf);
+    if (source_wav && source_filename == "-") {
+        wav_stream.reset(new wav_file(cin, wav_channel));
+        audio.sample_rate = wav_stream->get_sample_rate();
+    } else if (source_wav) {
+        wav.reset(new mapped_wav_file(source_filename, wav_channel));
+        audio.sample_rate = wav->get_sample_rate();
     } else {
         audio = record_audio();
     }
 
-    vector<pair<int, int>> ep = compute_endpoints(audio);
-    cout << "[*] Got " << ep.size() << " words:" << endl;
-    for (auto p : ep) {
-        cout << "[|]\t" << audio.samples_to_ms(p.first) << "ms - " << audio.samples_to_ms(p.second) << "ms" << endl;
-    }
+    // Sizes in milliseconds and the endpoints are at the analysis rate
+    audio_t timing;
+    timing.sample_rate = analysis_rate != 0 ? analysis_rate : audio.sample_rate;
 
     cout << "[*] Analyzing, please wait..." << endl;
     clip_t clip;
-    clip.window_size = duration_to_samples(audio, window_size);
-    clip.window_stride = duration_to_samples(audio, window_stride);
+    clip.window_size = duration_to_samples(timing, window_size);
+    clip.window_stride = duration_to_samples(timing, window_stride);
     clip.vector_size = vector_size;
+    clip.precision = precision;
+    clip.sample_rate = timing.sample_rate;
     clip.name = clip_name;
+
+    vector<pair<int, int>> ep;
+    if (wav_stream) {
+        clip.words = analyze_wav(*wav_stream,
+                                 ep,
+                                 clip.window_size,
+                                 clip.window_stride,
+                                 vector_size,
+                                 window_fn,
+                                 lpc_solver,
+                                 thread_count,
+                                 precision,
+                                 analysis_rate);
+    } else if (wav) {
+        clip.words = analyze_wav(*wav,
+                                 ep,
+                                 clip.window_size,
+                                 clip.window_stride,
+                                 vector_size,
+                                 window_fn,
+                                 lpc_solver,
+                                 thread_count,
+                                 precision,
+                                 analysis_rate);
+    } else {
+        clip.words = analyze_audio(audio,
+                                   ep,
+                                   clip.window_size,
+                                   clip.window_stride,
+                                   vector_size,
+                                   window_fn,
+                                   lpc_solver,
+                                   thread_count,
+                                   precision,
+                                   analysis_rate);
+    }
+
+    cout << "[*] Got " << ep.size() << " words:" << endl;
     for (auto p : ep) {
-        clip.words.push_back(analyze_word(audio.samples.begin() + p.first,
-                                          audio.samples.begin() + p.second,
-                                          clip.window_size,
-                                          clip.window_stride,
-                                          vector_size,
-                                          window_fn));
+        cout << "[|]\t" << timing.samples_to_ms(p.first) << "ms - " << timing.samples_to_ms(p.second) << "ms" << endl;
     }
     cout << "[+] Done!" << endl;
 
@@ -300,6 +419,41 @@ int parse_source_opts(int argc, char* argv[])
             } else {
                 throw command_line_exception("Unknown window type: `" + fn + "`");
             }
+        } else if (opt == "-l") {
+            string solver = argv[j + 1];
+            if (solver == "levinson") {
+                lpc_solver = SOLVER_LEVINSON;
+            } else if (solver == "armadillo") {
+                lpc_solver = SOLVER_ARMADILLO;
+            } else {
+                throw command_line_exception("Unknown LPC solver: `" + solver + "`");
+            }
+        } else if (opt == "-t") {
+            thread_count = string_to_integer(argv[j + 1]);
+        } else if (opt == "-n") {
+            string p = argv[j + 1];
+            if (p == "double") {
+                precision = PRECISION_DOUBLE;
+            } else if (p == "single") {
+                precision = PRECISION_SINGLE;
+            } else {
+                throw command_line_exception("Unknown precision: `" + p + "`");
+            }
+        } else if (opt == "-r") {
+            analysis_rate = string_to_integer(argv[j + 1]);
+            if (analysis_rate <= 0) {
+                throw command_line_exception("Sample rate must be greater than 0");
+            }
+        } else if (opt == "-c") {
+            string c = argv[j + 1];
+            if (c == "mix") {
+                wav_channel = PCM_DOWNMIX;
+            } else {
+                wav_channel = string_to_integer(c);
+                if (wav_channel < 0) {
+                    throw command_line_exception("Channel must not be negative");
+                }
+            }
         } else {
             throw command_line_exception("Unknown option: `" + opt + "`");
         }
@@ -317,6 +471,10 @@ int parse_source_opts(int argc, char* argv[])
         throw command_line_exception("Vector size must be greater than 0");
     }
 
+    if (thread_count <= 0) {
+        throw command_line_exception("Thread count must be greater than 0");
+    }
+
     return argc;
 }
 
@@ -358,6 +516,26 @@ void parse(int argc, char* argv[])
 
                 clip_name = argv[i];
                 command = CMD_DB_REMOVE;
+            } else if (cmd2 == "check") {
+                int i = offset + parse_db_opts(argc - offset, argv + offset);
+                if (i + 1 < argc && string(argv[i]) == "-t") {
+                    try {
+                        thread_count = string_to_integer(argv[i + 1]);
+                    } catch (format_exception& e) {
+                        throw command_line_exception(e.what());
+                    }
+                    i += 2;
+                }
+
+                if (i < argc) {
+                    throw command_line_exception("Extra arguments for 'db check'");
+                }
+
+                if (thread_count <= 0) {
+                    throw command_line_exception("Thread count must be greater than 0");
+                }
+
+                command = CMD_DB_CHECK;
             } else if (cmd2 == "list") {
                 int i = 1 + 2 + parse_db_opts(argc - 1 - 2, argv + 1 + 2);
                 if (i < argc) {
@@ -410,6 +588,7 @@ int main(int argc, char* argv[])
         switch(command) {
         case CMD_DB_LIST: do_db_list(); break;
         case CMD_DB_REMOVE: do_db_remove(); break;
+        case CMD_DB_CHECK: do_db_check(); break;
         case CMD_DB_ADD: do_db_add(); break;
         case CMD_DIFF: do_diff(); break;
         default: cerr << "Unknown command"; return -2;
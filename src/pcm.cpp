@@ -0,0 +1,390 @@
+#include "pcm.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+using namespace wordalyzer;
+using namespace std;
+
+namespace wordalyzer {
+    // Samples converted at a time by convert_pcm_frames() before they are
+    // mixed, small enough to stay in L1
+    const size_t PCM_BLOCK_SAMPLES = 2048;
+
+    typedef void (*conversion_kernel)(const uint8_t* source, size_t count, float* destination);
+    typedef void (*downmix_kernel)(const float* source, size_t frame_count, size_t channels, float* destination);
+
+    void convert_u8_scalar(const uint8_t* source, size_t count, float* destination);
+    void convert_s16_scalar(const uint8_t* source, size_t count, float* destination);
+    void convert_s24_scalar(const uint8_t* source, size_t count, float* destination);
+    void convert_s32_scalar(const uint8_t* source, size_t count, float* destination);
+    void downmix_scalar(const float* source, size_t frame_count, size_t channels, float* destination);
+    void select_channel(const float* source, size_t frame_count, size_t channels, size_t channel, float* destination);
+    conversion_kernel get_u8_conversion_kernel();
+    conversion_kernel get_s16_conversion_kernel();
+    conversion_kernel get_s24_conversion_kernel();
+    conversion_kernel get_s32_conversion_kernel();
+    downmix_kernel get_downmix_kernel();
+
+#ifdef WORDALYZER_X86
+    WORDALYZER_TARGET_AVX2 void convert_u8_avx2(const uint8_t* source, size_t count, float* destination);
+    WORDALYZER_TARGET_AVX2 void convert_s16_avx2(const uint8_t* source, size_t count, float* destination);
+    WORDALYZER_TARGET_AVX2 void convert_s24_avx2(const uint8_t* source, size_t count, float* destination);
+    WORDALYZER_TARGET_AVX2 void convert_s32_avx2(const uint8_t* source, size_t count, float* destination);
+    WORDALYZER_TARGET_AVX2 void downmix_avx2(const float* source, size_t frame_count, size_t channels, float* destination);
+#endif
+}
+
+void wordalyzer::convert_u8_scalar(const uint8_t* source, size_t count, float* destination)
+{
+    for (size_t i = 0; i < count; i++) {
+        destination[i] = 2.0f * (source[i] / 255.0f) - 1.0f;
+    }
+}
+
+void wordalyzer::convert_s16_scalar(const uint8_t* source, size_t count, float* destination)
+{
+    for (size_t i = 0; i < count; i++) {
+        int16_t sample;
+        memcpy(&sample, source + 2 * i, sizeof(int16_t));
+
+        if (sample < 0) {
+            destination[i] = static_cast<float>(sample) / (1 << 15);
+        } else {
+            destination[i] = static_cast<float>(sample) / ((1 << 15) - 1);
+        }
+    }
+}
+
+void wordalyzer::convert_s24_scalar(const uint8_t* source, size_t count, float* destination)
+{
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* bytes = source + 3 * i;
+
+        // Build the sample in the top three bytes and shift it back down to
+        // extend the sign
+        uint32_t word = (uint32_t(bytes[0]) << 8) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 24);
+        int32_t sample = static_cast<int32_t>(word) >> 8;
+
+        if (sample < 0) {
+            destination[i] = static_cast<float>(sample) / (1 << 23);
+        } else {
+            destination[i] = static_cast<float>(sample) / ((1 << 23) - 1);
+        }
+    }
+}
+
+void wordalyzer::convert_s32_scalar(const uint8_t* source, size_t count, float* destination)
+{
+    for (size_t i = 0; i < count; i++) {
+        int32_t sample;
+        memcpy(&sample, source + 4 * i, sizeof(int32_t));
+
+        // A float cannot hold every 32-bit sample, so scale them as doubles
+        if (sample < 0) {
+            destination[i] = static_cast<float>(sample / 2147483648.0);
+        } else {
+            destination[i] = static_cast<float>(sample / 2147483647.0);
+        }
+    }
+}
+
+void wordalyzer::downmix_scalar(const float* source, size_t frame_count, size_t channels, float* destination)
+{
+    for (size_t i = 0; i < frame_count; i++) {
+        const float* frame = source + i * channels;
+
+        float sum = frame[0];
+        for (size_t c = 1; c < channels; c++) {
+            sum += frame[c];
+        }
+
+        destination[i] = sum / static_cast<float>(channels);
+    }
+}
+
+void wordalyzer::select_channel(const float* source, size_t frame_count, size_t channels, size_t channel, float* destination)
+{
+    for (size_t i = 0; i < frame_count; i++) {
+        destination[i] = source[i * channels + channel];
+    }
+}
+
+#ifdef WORDALYZER_X86
+// The vector kernels do the same divisions as the scalar ones rather than
+// multiplying by reciprocals, which would round differently.
+WORDALYZER_TARGET_AVX2
+void wordalyzer::convert_u8_avx2(const uint8_t* source, size_t count, float* destination)
+{
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + i));
+        __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+        _mm256_storeu_ps(destination + i, _mm256_sub_ps(_mm256_mul_ps(two, _mm256_div_ps(x, scale)), one));
+    }
+
+    convert_u8_scalar(source + i, count - i, destination + i);
+}
+
+WORDALYZER_TARGET_AVX2
+void wordalyzer::convert_s16_avx2(const uint8_t* source, size_t count, float* destination)
+{
+    const __m256 negative_scale = _mm256_set1_ps(1 << 15);
+    const __m256 positive_scale = _mm256_set1_ps((1 << 15) - 1);
+    const __m256 zero = _mm256_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 2 * i));
+        __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(words));
+
+        __m256 negative = _mm256_div_ps(x, negative_scale);
+        __m256 positive = _mm256_div_ps(x, positive_scale);
+        __m256 is_negative = _mm256_cmp_ps(x, zero, _CMP_LT_OQ);
+        _mm256_storeu_ps(destination + i, _mm256_blendv_ps(positive, negative, is_negative));
+    }
+
+    convert_s16_scalar(source + 2 * i, count - i, destination + i);
+}
+
+WORDALYZER_TARGET_AVX2
+void wordalyzer::convert_s24_avx2(const uint8_t* source, size_t count, float* destination)
+{
+    // Moves each of the four samples in a lane to the top three bytes of
+    // its 32-bit element
+    const __m256i shuffle = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                                             -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    const __m256 negative_scale = _mm256_set1_ps(1 << 23);
+    const __m256 positive_scale = _mm256_set1_ps((1 << 23) - 1);
+    const __m256 zero = _mm256_setzero_ps();
+
+    // Each half loads 16 bytes for the 12 it uses, so stop early enough not
+    // to read past the end of the source
+    size_t i = 0;
+    for (; i + 10 <= count; i += 8) {
+        const uint8_t* bytes = source + 3 * i;
+        __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+        __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 12));
+        __m256i packed = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+
+        __m256i samples = _mm256_srai_epi32(_mm256_shuffle_epi8(packed, shuffle), 8);
+        __m256 x = _mm256_cvtepi32_ps(samples);
+
+        __m256 negative = _mm256_div_ps(x, negative_scale);
+        __m256 positive = _mm256_div_ps(x, positive_scale);
+        __m256 is_negative = _mm256_cmp_ps(x, zero, _CMP_LT_OQ);
+        _mm256_storeu_ps(destination + i, _mm256_blendv_ps(positive, negative, is_negative));
+    }
+
+    convert_s24_scalar(source + 3 * i, count - i, destination + i);
+}
+
+WORDALYZER_TARGET_AVX2
+void wordalyzer::convert_s32_avx2(const uint8_t* source, size_t count, float* destination)
+{
+    const __m256d negative_scale = _mm256_set1_pd(2147483648.0);
+    const __m256d positive_scale = _mm256_set1_pd(2147483647.0);
+    const __m256d zero = _mm256_setzero_pd();
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 4 * i));
+        __m256d x = _mm256_cvtepi32_pd(words);
+
+        __m256d negative = _mm256_div_pd(x, negative_scale);
+        __m256d positive = _mm256_div_pd(x, positive_scale);
+        __m256d is_negative = _mm256_cmp_pd(x, zero, _CMP_LT_OQ);
+        _mm_storeu_ps(destination + i, _mm256_cvtpd_ps(_mm256_blendv_pd(positive, negative, is_negative)));
+    }
+
+    convert_s32_scalar(source + 4 * i, count - i, destination + i);
+}
+
+WORDALYZER_TARGET_AVX2
+void wordalyzer::downmix_avx2(const float* source, size_t frame_count, size_t channels, float* destination)
+{
+    const __m256 divisor = _mm256_set1_ps(static_cast<float>(channels));
+
+    size_t i = 0;
+    if (channels == 2) {
+        // Stereo is common enough to add neighbouring pairs directly
+        for (; i + 8 <= frame_count; i += 8) {
+            __m256 a = _mm256_loadu_ps(source + 2 * i);
+            __m256 b = _mm256_loadu_ps(source + 2 * i + 8);
+
+            // The sums of frames 0 1 4 5 | 2 3 6 7, put back in order
+            __m256 sums = _mm256_hadd_ps(a, b);
+            sums = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sums), 0xd8));
+            _mm256_storeu_ps(destination + i, _mm256_div_ps(sums, divisor));
+        }
+    } else {
+        // Gather a channel of eight frames at a time, adding the channels in
+        // the same order as the scalar code
+        const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                                 _mm256_set1_epi32(static_cast<int>(channels)));
+        for (; i + 8 <= frame_count; i += 8) {
+            const float* frames = source + i * channels;
+
+            __m256 sum = _mm256_i32gather_ps(frames, index, sizeof(float));
+            for (size_t c = 1; c < channels; c++) {
+                sum = _mm256_add_ps(sum, _mm256_i32gather_ps(frames + c, index, sizeof(float)));
+            }
+            _mm256_storeu_ps(destination + i, _mm256_div_ps(sum, divisor));
+        }
+    }
+
+    downmix_scalar(source + i * channels, frame_count - i, channels, destination + i);
+}
+#endif
+
+conversion_kernel wordalyzer::get_u8_conversion_kernel()
+{
+#ifdef WORDALYZER_X86
+    if (cpu_has_avx2()) {
+        return convert_u8_avx2;
+    }
+#endif
+
+    return convert_u8_scalar;
+}
+
+conversion_kernel wordalyzer::get_s16_conversion_kernel()
+{
+#ifdef WORDALYZER_X86
+    if (cpu_has_avx2()) {
+        return convert_s16_avx2;
+    }
+#endif
+
+    return convert_s16_scalar;
+}
+
+conversion_kernel wordalyzer::get_s24_conversion_kernel()
+{
+#ifdef WORDALYZER_X86
+    if (cpu_has_avx2()) {
+        return convert_s24_avx2;
+    }
+#endif
+
+    return convert_s24_scalar;
+}
+
+conversion_kernel wordalyzer::get_s32_conversion_kernel()
+{
+#ifdef WORDALYZER_X86
+    if (cpu_has_avx2()) {
+        return convert_s32_avx2;
+    }
+#endif
+
+    return convert_s32_scalar;
+}
+
+downmix_kernel wordalyzer::get_downmix_kernel()
+{
+#ifdef WORDALYZER_X86
+    if (cpu_has_avx2()) {
+        return downmix_avx2;
+    }
+#endif
+
+    return downmix_scalar;
+}
+
+size_t wordalyzer::get_pcm_sample_size(pcm_encoding_t encoding)
+{
+    switch (encoding) {
+    case PCM_U8: return 1;
+    case PCM_S16: return 2;
+    case PCM_S24: return 3;
+    case PCM_S32: return 4;
+    case PCM_F32: return 4;
+    }
+
+    assert(false && "Unknown PCM encoding");
+    return 0;
+}
+
+void wordalyzer::convert_u8_samples(const uint8_t* source, size_t count, float* destination)
+{
+    static const conversion_kernel kernel = get_u8_conversion_kernel();
+    kernel(source, count, destination);
+}
+
+void wordalyzer::convert_s16_samples(const void* source, size_t count, float* destination)
+{
+    static const conversion_kernel kernel = get_s16_conversion_kernel();
+    kernel(static_cast<const uint8_t*>(source), count, destination);
+}
+
+void wordalyzer::convert_s24_samples(const void* source, size_t count, float* destination)
+{
+    static const conversion_kernel kernel = get_s24_conversion_kernel();
+    kernel(static_cast<const uint8_t*>(source), count, destination);
+}
+
+void wordalyzer::convert_s32_samples(const void* source, size_t count, float* destination)
+{
+    static const conversion_kernel kernel = get_s32_conversion_kernel();
+    kernel(static_cast<const uint8_t*>(source), count, destination);
+}
+
+void wordalyzer::convert_f32_samples(const void* source, size_t count, float* destination)
+{
+    // Assuming a little-endian CPU architecture, like the WAV reader
+    memcpy(destination, source, count * sizeof(float));
+}
+
+void wordalyzer::convert_pcm_samples(const uint8_t* source, size_t count, pcm_encoding_t encoding, float* destination)
+{
+    switch (encoding) {
+    case PCM_U8: convert_u8_samples(source, count, destination); break;
+    case PCM_S16: convert_s16_samples(source, count, destination); break;
+    case PCM_S24: convert_s24_samples(source, count, destination); break;
+    case PCM_S32: convert_s32_samples(source, count, destination); break;
+    case PCM_F32: convert_f32_samples(source, count, destination); break;
+    }
+}
+
+void wordalyzer::downmix_samples(const float* source, size_t frame_count, size_t channels, float* destination)
+{
+    static const downmix_kernel kernel = get_downmix_kernel();
+    kernel(source, frame_count, channels, destination);
+}
+
+void wordalyzer::convert_pcm_frames(const uint8_t* source,
+                                    size_t frame_count,
+                                    pcm_encoding_t encoding,
+                                    size_t channels,
+                                    int channel,
+                                    float* destination)
+{
+    assert(channels > 0 && channels <= PCM_MAX_CHANNELS);
+    assert(channel == PCM_DOWNMIX || (channel >= 0 && static_cast<size_t>(channel) < channels));
+
+    if (channels == 1) {
+        convert_pcm_samples(source, frame_count, encoding, destination);
+        return;
+    }
+
+    const size_t frame_size = get_pcm_sample_size(encoding) * channels;
+    const size_t block_frames = PCM_BLOCK_SAMPLES / channels;
+
+    float block[PCM_BLOCK_SAMPLES];
+    for (size_t first = 0; first < frame_count; first += block_frames) {
+        size_t count = min(block_frames, frame_count - first);
+        convert_pcm_samples(source + first * frame_size, count * channels, encoding, block);
+
+        if (channel == PCM_DOWNMIX) {
+            downmix_samples(block, count, channels, destination + first);
+        } else {
+            select_channel(block, count, channels, channel, destination + first);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace wordalyzer {
+    // Conversions from PCM samples to floats in [-1, 1], shared by the WAV
+    // reader and the recorder. Every kernel gives exactly the same result
+    // as the scalar code, whichever instruction set it runs on.
+
+    // The encodings of a single sample. Integer samples are little-endian
+    // and do not have to be aligned.
+    enum pcm_encoding_t {
+        PCM_U8,
+        PCM_S16,
+        PCM_S24,
+        PCM_S32,
+        PCM_F32
+    };
+
+    // Passed instead of a channel index to average all channels together
+    const int PCM_DOWNMIX = -1;
+
+    // The most channels convert_pcm_frames() accepts
+    const size_t PCM_MAX_CHANNELS = 64;
+
+    size_t get_pcm_sample_size(pcm_encoding_t encoding);
+
+    // Unsigned 8-bit samples, centered at 128
+    void convert_u8_samples(const std::uint8_t* source, size_t count, float* destination);
+
+    // Signed integer samples. Negative samples are divided by 2^(n-1) and
+    // positive ones by 2^(n-1) - 1, so that both ends of the range map to
+    // exactly -1 and 1. 32-bit samples are scaled in double precision.
+    void convert_s16_samples(const void* source, size_t count, float* destination);
+    void convert_s24_samples(const void* source, size_t count, float* destination);
+    void convert_s32_samples(const void* source, size_t count, float* destination);
+
+    // IEEE floats, copied as they are
+    void convert_f32_samples(const void* source, size_t count, float* destination);
+
+    void convert_pcm_samples(const std::uint8_t* source, size_t count, pcm_encoding_t encoding, float* destination);
+
+    // Sets each of `frame_count` destination samples to the average of the
+    // `channels` interleaved samples of its frame.
+    void downmix_samples(const float* source, size_t frame_count, size_t channels, float* destination);
+
+    // Converts `frame_count` interleaved frames of `channels` samples to
+    // one sample per frame, either the given channel or, with PCM_DOWNMIX,
+    // the average of all of them. Frames are converted and mixed a block at
+    // a time, so the data is only read once.
+    void convert_pcm_frames(const std::uint8_t* source,
+                            size_t frame_count,
+                            pcm_encoding_t encoding,
+                            size_t channels,
+                            int channel,
+                            float* destination);
+}
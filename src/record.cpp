@@ -3,6 +3,7 @@
 #include <iostream>
 
 #include "record.hpp"
+#include "pcm.hpp"
 
 using namespace wordalyzer;
 using namespace std;
@@ -35,9 +36,7 @@ audio_t wordalyzer::record_audio()
     res.samples.resize(sample_count);
     res.sample_rate = buf.getSampleRate();
 
-    for (size_t i = 0; i < sample_count; i++) {
-        res.samples[i] = samples[i] / 32767.0f;
-    }
+    convert_s16_samples(samples, sample_count, res.samples.data());
 
     cout << "[+] Successfully recorded " << res.samples_to_ms(sample_count) << "ms" << endl;
 
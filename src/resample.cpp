@@ -0,0 +1,338 @@
+#include "resample.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <map>
+#include <mutex>
+
+using namespace wordalyzer;
+using namespace std;
+
+namespace wordalyzer {
+    // Zero crossings of the sinc on each side of its center, at the lower
+    // of the two rates. More of them make the transition band narrower.
+    const double RESAMPLE_ZERO_CROSSINGS = 16.0;
+
+    // Cutoff of the lowpass filter, as a fraction of the lower Nyquist
+    // rate. The rest of the band is left for the transition, so that little
+    // above the Nyquist rate aliases back.
+    const double RESAMPLE_PASSBAND = 0.95;
+
+    // Ratios that need more phases than this are refused, as their filter
+    // banks would take megabytes
+    const size_t RESAMPLE_MAX_PHASES = 1024;
+
+    // Computes output samples from `history`, starting at `position` with
+    // the taps of `phase`, until `limit` samples are written or the next
+    // one would read past `available` samples. Advances `position` and
+    // `phase` past the samples written and returns their count.
+    typedef size_t (*resample_kernel)(const float* history,
+                                      size_t available,
+                                      const filter_bank_t& bank,
+                                      size_t down,
+                                      size_t& position,
+                                      size_t& phase,
+                                      size_t limit,
+                                      float* destination);
+
+    size_t resample_scalar(const float* history,
+                           size_t available,
+                           const filter_bank_t& bank,
+                           size_t down,
+                           size_t& position,
+                           size_t& phase,
+                           size_t limit,
+                           float* destination);
+    resample_kernel get_resample_kernel();
+    void advance_output(size_t& position, size_t& phase, size_t step, size_t step_phase, size_t up);
+
+#ifdef WORDALYZER_X86
+    WORDALYZER_TARGET_AVX2 size_t resample_avx2(const float* history,
+                                                size_t available,
+                                                const filter_bank_t& bank,
+                                                size_t down,
+                                                size_t& position,
+                                                size_t& phase,
+                                                size_t limit,
+                                                float* destination);
+#endif
+
+    size_t greatest_common_divisor(size_t a, size_t b);
+    shared_ptr<const filter_bank_t> build_filter_bank(size_t up, size_t down);
+    shared_ptr<const filter_bank_t> get_filter_bank(size_t up, size_t down);
+}
+
+// Moves on to the next output, `down / up` input samples later. Splitting
+// the step beforehand keeps divisions out of the kernels' loops.
+inline void wordalyzer::advance_output(size_t& position, size_t& phase, size_t step, size_t step_phase, size_t up)
+{
+    position += step;
+    phase += step_phase;
+    if (phase >= up) {
+        phase -= up;
+        position++;
+    }
+}
+
+size_t wordalyzer::resample_scalar(const float* history,
+                                   size_t available,
+                                   const filter_bank_t& bank,
+                                   size_t down,
+                                   size_t& position,
+                                   size_t& phase,
+                                   size_t limit,
+                                   float* destination)
+{
+    const size_t taps = bank.taps, up = bank.phases;
+    const size_t step = down / up, step_phase = down % up;
+
+    size_t n = 0;
+    for (; n < limit && position + taps <= available; n++) {
+        const float* x = history + position;
+        const float* h = &bank.coeffs[phase * taps];
+
+        float lanes[8] = { 0.0f };
+        for (size_t i = 0; i < taps; i += 8) {
+            for (int l = 0; l < 8; l++) {
+                lanes[l] += x[i + l] * h[i + l];
+            }
+        }
+        destination[n] = ((lanes[0] + lanes[4]) + (lanes[1] + lanes[5])) + ((lanes[2] + lanes[6]) + (lanes[3] + lanes[7]));
+
+        advance_output(position, phase, step, step_phase, up);
+    }
+
+    return n;
+}
+
+#ifdef WORDALYZER_X86
+// Computes four outputs at a time, so that their multiply-adds do not wait
+// for each other. The sums are in a different order than in the scalar
+// kernel and the multiply-adds are fused, so the results may differ in the
+// last bits.
+WORDALYZER_TARGET_AVX2
+size_t wordalyzer::resample_avx2(const float* history,
+                                 size_t available,
+                                 const filter_bank_t& bank,
+                                 size_t down,
+                                 size_t& position,
+                                 size_t& phase,
+                                 size_t limit,
+                                 float* destination)
+{
+    const size_t taps = bank.taps, up = bank.phases;
+    const size_t step = down / up, step_phase = down % up;
+    const float* coeffs = bank.coeffs.data();
+
+    size_t n = 0;
+    while (n + 4 <= limit) {
+        size_t position_1 = position, phase_1 = phase;
+        advance_output(position_1, phase_1, step, step_phase, up);
+        size_t position_2 = position_1, phase_2 = phase_1;
+        advance_output(position_2, phase_2, step, step_phase, up);
+        size_t position_3 = position_2, phase_3 = phase_2;
+        advance_output(position_3, phase_3, step, step_phase, up);
+
+        if (position_3 + taps > available) {
+            break;
+        }
+
+        const float* x0 = history + position;
+        const float* x1 = history + position_1;
+        const float* x2 = history + position_2;
+        const float* x3 = history + position_3;
+        const float* h0 = coeffs + phase * taps;
+        const float* h1 = coeffs + phase_1 * taps;
+        const float* h2 = coeffs + phase_2 * taps;
+        const float* h3 = coeffs + phase_3 * taps;
+
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        for (size_t i = 0; i < taps; i += 8) {
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x0 + i), _mm256_loadu_ps(h0 + i), acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x1 + i), _mm256_loadu_ps(h1 + i), acc1);
+            acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(x2 + i), _mm256_loadu_ps(h2 + i), acc2);
+            acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(x3 + i), _mm256_loadu_ps(h3 + i), acc3);
+        }
+
+        // Each 128-bit half ends up with the half sums of all four outputs
+        __m256 sums = _mm256_hadd_ps(_mm256_hadd_ps(acc0, acc1), _mm256_hadd_ps(acc2, acc3));
+        _mm_storeu_ps(destination + n, _mm_add_ps(_mm256_castps256_ps128(sums), _mm256_extractf128_ps(sums, 1)));
+        n += 4;
+
+        position = position_3;
+        phase = phase_3;
+        advance_output(position, phase, step, step_phase, up);
+    }
+
+    // The rest one at a time, adding up the same way, so that the output
+    // does not depend on how the input was split into blocks
+    for (; n < limit && position + taps <= available; n++) {
+        const float* x = history + position;
+        const float* h = coeffs + phase * taps;
+
+        __m256 acc = _mm256_setzero_ps();
+        for (size_t i = 0; i < taps; i += 8) {
+            acc = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(h + i), acc);
+        }
+
+        __m256 sums = _mm256_hadd_ps(acc, acc);
+        sums = _mm256_hadd_ps(sums, sums);
+        destination[n] = _mm_cvtss_f32(_mm_add_ps(_mm256_castps256_ps128(sums), _mm256_extractf128_ps(sums, 1)));
+
+        advance_output(position, phase, step, step_phase, up);
+    }
+
+    return n;
+}
+#endif
+
+resample_kernel wordalyzer::get_resample_kernel()
+{
+#ifdef WORDALYZER_X86
+    if (cpu_has_avx2()) {
+        return resample_avx2;
+    }
+#endif
+
+    return resample_scalar;
+}
+
+size_t wordalyzer::greatest_common_divisor(size_t a, size_t b)
+{
+    while (b != 0) {
+        size_t r = a % b;
+        a = b;
+        b = r;
+    }
+
+    return a;
+}
+
+shared_ptr<const filter_bank_t> wordalyzer::build_filter_bank(size_t up, size_t down)
+{
+    // The cutoff, relative to the input Nyquist rate. The filter stretches
+    // by as much when decimating, to keep the same number of zero crossings.
+    double cutoff = min(1.0, static_cast<double>(up) / down) * RESAMPLE_PASSBAND;
+    size_t half = static_cast<size_t>(ceil(RESAMPLE_ZERO_CROSSINGS / cutoff));
+
+    shared_ptr<filter_bank_t> bank = make_shared<filter_bank_t>();
+    bank->phases = up;
+    bank->taps = (2 * half + 7) / 8 * 8;
+    bank->center = half - 1;
+    bank->coeffs.assign(bank->phases * bank->taps, 0.0f);
+
+    vector<double> h(2 * half);
+    for (size_t p = 0; p < up; p++) {
+        // The output position is `p / up` of the way from the input sample
+        // under the center tap to the next one
+        double offset = static_cast<double>(p) / up;
+        double sum = 0.0;
+        for (size_t j = 0; j < 2 * half; j++) {
+            double d = static_cast<double>(j) - bank->center - offset;
+            double x = d / half;
+            if (fabs(x) >= 1.0) {
+                h[j] = 0.0;
+                continue;
+            }
+
+            double t = M_PI * cutoff * d;
+            double sinc = t == 0.0 ? 1.0 : sin(t) / t;
+            double blackman = 0.42 + 0.5 * cos(M_PI * x) + 0.08 * cos(2.0 * M_PI * x);
+            h[j] = cutoff * sinc * blackman;
+            sum += h[j];
+        }
+
+        // Normalize every phase to unit gain at DC, so that a constant
+        // input stays constant whatever the phase
+        for (size_t j = 0; j < 2 * half; j++) {
+            bank->coeffs[p * bank->taps + j] = h[j] / sum;
+        }
+    }
+
+    return bank;
+}
+
+shared_ptr<const filter_bank_t> wordalyzer::get_filter_bank(size_t up, size_t down)
+{
+    static mutex cache_mutex;
+    static map<pair<size_t, size_t>, shared_ptr<const filter_bank_t>> cache;
+
+    lock_guard<mutex> lock(cache_mutex);
+    auto it = cache.find(make_pair(up, down));
+    if (it != cache.end()) {
+        return it->second;
+    }
+
+    shared_ptr<const filter_bank_t> bank = build_filter_bank(up, down);
+    cache[make_pair(up, down)] = bank;
+    return bank;
+}
+
+resampler::resampler(int _input_rate, int _output_rate)
+    : input_rate(_input_rate), output_rate(_output_rate)
+{
+    if (input_rate <= 0 || output_rate <= 0) {
+        throw resample_exception("Sample rates must be greater than 0");
+    }
+
+    size_t divisor = greatest_common_divisor(input_rate, output_rate);
+    up = output_rate / divisor;
+    down = input_rate / divisor;
+
+    if (up > RESAMPLE_MAX_PHASES) {
+        throw resample_exception("Cannot resample from " + to_string(input_rate) + " Hz to " +
+                                 to_string(output_rate) + " Hz: the ratio between the rates is too complex");
+    }
+
+    bank = get_filter_bank(up, down);
+}
+
+uint64_t resampler::get_output_index(uint64_t input) const
+{
+    return (input * up + down - 1) / down;
+}
+
+void resampler::get_input_range(uint64_t first, size_t count, int64_t& input_begin, int64_t& input_end) const
+{
+    // Output `n` reads `taps` samples from `center` before the input sample
+    // at or before its position on
+    int64_t first_position = first * down / up;
+    int64_t last_position = (first + max<size_t>(count, 1) - 1) * down / up;
+
+    input_begin = first_position - static_cast<int64_t>(bank->center);
+    input_end = count > 0 ? last_position - static_cast<int64_t>(bank->center) + bank->taps : input_begin;
+}
+
+void resampler::resample(const float* input,
+                         int64_t input_first,
+                         size_t input_count,
+                         uint64_t first,
+                         size_t count,
+                         float* destination)
+{
+    static const resample_kernel kernel = get_resample_kernel();
+
+    if (count == 0) {
+        return;
+    }
+
+    // Gather the input the outputs read, with silence wherever it is not
+    // given
+    int64_t input_begin, input_end;
+    get_input_range(first, count, input_begin, input_end);
+
+    scratch.assign(input_end - input_begin, 0.0f);
+    int64_t copy_begin = max(input_begin, input_first);
+    int64_t copy_end = min(input_end, input_first + static_cast<int64_t>(input_count));
+    if (copy_begin < copy_end) {
+        copy(input + (copy_begin - input_first), input + (copy_end - input_first), scratch.begin() + (copy_begin - input_begin));
+    }
+
+    size_t position = 0;
+    size_t phase = first * down % up;
+    size_t n = kernel(scratch.data(), scratch.size(), *bank, down, position, phase, count, destination);
+    assert(n == count);
+    (void) n;
+}
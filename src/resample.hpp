@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace wordalyzer {
+    class resample_exception : public std::exception {
+    private:
+        std::string message;
+
+    public:
+        resample_exception(const std::string& _message)
+            : message(_message) {}
+
+        virtual const char* what() const throw() {
+            return message.c_str();
+        }
+    };
+
+    // The taps of a windowed-sinc lowpass filter, split into one phase per
+    // output position between two input samples. Each phase has the same
+    // number of taps, a multiple of 8 padded with zeros.
+    struct filter_bank_t {
+        size_t phases;
+        size_t taps;
+
+        // The tap that falls on the input sample at or before the output
+        // position
+        size_t center;
+
+        std::vector<float> coeffs;
+    };
+
+    // Converts samples from one rate to another, by a rational factor.
+    // Output sample `n` is taken at input time `n * input_rate /
+    // output_rate`, so the output is not delayed, and any range of it can
+    // be computed on its own: only the input samples around it are read.
+    // The filter bank for a ratio is computed once and shared by every
+    // resampler that uses it.
+    class resampler {
+    public:
+        resampler(int _input_rate, int _output_rate);
+
+        int get_input_rate() const {
+            return input_rate;
+        }
+
+        int get_output_rate() const {
+            return output_rate;
+        }
+
+        // The first output sample at or after input sample `input`
+        std::uint64_t get_output_index(std::uint64_t input) const;
+
+        // The input samples that output samples [first, first + count)
+        // read, from `input_begin` to `input_end`. The range may start
+        // before the first input sample.
+        void get_input_range(std::uint64_t first,
+                             size_t count,
+                             std::int64_t& input_begin,
+                             std::int64_t& input_end) const;
+
+        // Computes output samples [first, first + count) to `destination`,
+        // from the `input_count` input samples at `input`, which start at
+        // input sample `input_first`. Input samples outside of those are
+        // read as silence.
+        void resample(const float* input,
+                      std::int64_t input_first,
+                      size_t input_count,
+                      std::uint64_t first,
+                      size_t count,
+                      float* destination);
+
+    private:
+        int input_rate, output_rate;
+        std::shared_ptr<const filter_bank_t> bank;
+        size_t up, down;
+
+        // The input samples read by the outputs being computed
+        std::vector<float> scratch;
+    };
+}
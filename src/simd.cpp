@@ -0,0 +1,50 @@
+#include "simd.hpp"
+#include <cstdlib>
+#include <cstring>
+
+using namespace wordalyzer;
+
+namespace wordalyzer {
+    enum SimdLevel {
+        SIMD_SCALAR,
+        SIMD_SSE2,
+        SIMD_AVX2
+    };
+
+    SimdLevel get_simd_limit();
+}
+
+wordalyzer::SimdLevel wordalyzer::get_simd_limit()
+{
+    const char* limit = getenv("WORDALYZER_SIMD");
+    if (limit != nullptr && strcmp(limit, "scalar") == 0) {
+        return SIMD_SCALAR;
+    }
+
+    if (limit != nullptr && strcmp(limit, "sse2") == 0) {
+        return SIMD_SSE2;
+    }
+
+    return SIMD_AVX2;
+}
+
+bool wordalyzer::cpu_has_sse2()
+{
+#ifdef WORDALYZER_X86
+    static const bool supported = __builtin_cpu_supports("sse2") && get_simd_limit() >= SIMD_SSE2;
+    return supported;
+#else
+    return false;
+#endif
+}
+
+bool wordalyzer::cpu_has_avx2()
+{
+#ifdef WORDALYZER_X86
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+                                  get_simd_limit() >= SIMD_AVX2;
+    return supported;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WORDALYZER_X86
+#include <immintrin.h>
+
+// Mark a function as compiled for a given instruction set regardless of the
+// global target, so it can be selected at runtime on CPUs that support it.
+#define WORDALYZER_TARGET_SSE2 __attribute__((target("sse2")))
+#define WORDALYZER_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace wordalyzer {
+    // Runtime CPU feature detection, used to dispatch between kernels.
+    // Setting WORDALYZER_SIMD to "scalar" or "sse2" in the environment
+    // reports the instruction sets above it as missing, so that the other
+    // kernels can be tested and timed on the same machine.
+    bool cpu_has_sse2();
+    bool cpu_has_avx2();
+}
@@ -1,6 +1,13 @@
 #include "wav.hpp"
+#include "pcm.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace wordalyzer;
 using namespace std;
@@ -11,9 +18,12 @@ namespace wordalyzer {
     const uint32_t DATA_MAGIC = 0x61746164;
     const uint32_t WAVE_MAGIC = 0x45564157;
     const size_t   FMT_CHUNK_SIZE = 16;
+    const size_t   FMT_EXTENSIBLE_CHUNK_SIZE = 40;
 
     enum audio_format_t {
-        FORMAT_LPCM = 1
+        FORMAT_LPCM = 1,
+        FORMAT_IEEE_FLOAT = 3,
+        FORMAT_EXTENSIBLE = 0xfffe
     };
 
     struct __attribute__((packed)) riff_hdr_t {
@@ -36,9 +46,21 @@ namespace wordalyzer {
         uint16_t            bits_per_sample;
     };
 
+    // Follows the FMT chunk of WAVE_FORMAT_EXTENSIBLE files. The sub format
+    // is a GUID that starts with the actual audio format.
+    struct __attribute__((packed)) fmt_extension_t {
+        uint16_t            extension_size;
+        uint16_t            valid_bits_per_sample;
+        uint32_t            channel_mask;
+        uint16_t            sub_format;
+        uint8_t             sub_format_guid[14];
+    };
+
     struct wav_info_t {
         riff_hdr_t          riff_hdr;
         fmt_chunk_t         fmt_chunk;
+        bool                has_fmt_extension;
+        fmt_extension_t     fmt_extension;
         chunk_hdr_t         data_chunk_hdr;
     };
 
@@ -68,14 +90,17 @@ namespace wordalyzer {
         }
     }
 
-    void wav_file_check_sanity(const wav_info_t& hdr)
+    // Checks that the samples can be decoded and returns their encoding
+    pcm_encoding_t wav_file_check_sanity(const wav_info_t& hdr)
     {
-        // Check if we're dealing with some weird compression
         const fmt_chunk_t& fmt = hdr.fmt_chunk;
-        switch (convert_endianness(fmt.audio_format)) {
-            case FORMAT_LPCM: break;
-            default:
-                throw wav_file_parse_exception("Unsupported audio format (only LPCM is supported)");
+        size_t audio_format = convert_endianness(fmt.audio_format);
+        if (audio_format == FORMAT_EXTENSIBLE) {
+            if (!hdr.has_fmt_extension) {
+                throw wav_file_parse_exception("Unexpected length for extensible FMT chunk (should be at least 40)");
+            }
+
+            audio_format = convert_endianness(hdr.fmt_extension.sub_format);
         }
 
         if (convert_endianness(fmt.sample_rate) == 0) {
@@ -86,20 +111,44 @@ namespace wordalyzer {
             throw wav_file_parse_exception("Zero channels");
         }
 
+        if (convert_endianness(fmt.num_channels) > PCM_MAX_CHANNELS) {
+            throw wav_file_parse_exception("Too many channels (at most " + to_string(PCM_MAX_CHANNELS) + " are supported)");
+        }
+
         size_t bits_per_sample = convert_endianness(fmt.bits_per_sample);
         if (bits_per_sample == 0) {
             throw wav_file_parse_exception("Bits per sample is 0");
         }
 
-        if (bits_per_sample != 8 && bits_per_sample != 16) {
-            throw wav_file_parse_exception("Unsupported sample bit depth");
+        // Check if we're dealing with some weird compression. Samples with
+        // fewer valid bits than their container are padded with zeros at
+        // the bottom, so they are decoded like full ones.
+        switch (audio_format) {
+        case FORMAT_LPCM:
+            switch (bits_per_sample) {
+            case 8: return PCM_U8;
+            case 16: return PCM_S16;
+            case 24: return PCM_S24;
+            case 32: return PCM_S32;
+            default:
+                throw wav_file_parse_exception("Unsupported sample bit depth");
+            }
+
+        case FORMAT_IEEE_FLOAT:
+            if (bits_per_sample != 32) {
+                throw wav_file_parse_exception("Unsupported sample bit depth (only 32-bit floats are supported)");
+            }
+            return PCM_F32;
+
+        default:
+            throw wav_file_parse_exception("Unsupported audio format (only LPCM and IEEE float are supported)");
         }
     }
 
     void wav_file_read_chunks(wav_info_t& destination, istream& file)
     {
         bool found_fmt = false, found_data = false;
-        char buffer[sizeof(fmt_chunk_t)];
+        char buffer[sizeof(fmt_chunk_t) + sizeof(fmt_extension_t)];
 
         while (!file.eof() && (!found_fmt || !found_data)) {
             union {
@@ -109,18 +158,25 @@ namespace wordalyzer {
 
             file.read(h.bytes, sizeof(chunk_hdr_t));
             switch (convert_endianness(h.hdr.chunk_id)) {
-            case FMT_MAGIC:
-                if (convert_endianness(h.hdr.chunk_size) < FMT_CHUNK_SIZE) {
+            case FMT_MAGIC: {
+                size_t chunk_size = convert_endianness(h.hdr.chunk_size);
+                if (chunk_size < FMT_CHUNK_SIZE) {
                     throw wav_file_parse_exception("Unexpected length for FMT chunk (should be at least 16)");
                 }
 
                 found_fmt = true;
-                file.read(buffer, sizeof(fmt_chunk_t));
-                file.ignore(convert_endianness(h.hdr.chunk_size) - FMT_CHUNK_SIZE);
+                destination.has_fmt_extension = chunk_size >= FMT_EXTENSIBLE_CHUNK_SIZE;
+                size_t read_size = destination.has_fmt_extension ? FMT_EXTENSIBLE_CHUNK_SIZE : FMT_CHUNK_SIZE;
+                file.read(buffer, read_size);
+                file.ignore(chunk_size - read_size);
 
                 memcpy(reinterpret_cast<char*>(&destination.fmt_chunk), buffer, sizeof(fmt_chunk_t));
+                if (destination.has_fmt_extension) {
+                    memcpy(reinterpret_cast<char*>(&destination.fmt_extension), buffer + FMT_CHUNK_SIZE, sizeof(fmt_extension_t));
+                }
 
                 break;
+            }
 
             case DATA_MAGIC:
                 if (!found_fmt) {
@@ -146,9 +202,89 @@ namespace wordalyzer {
         }
     }
 
+    // Same as wav_file_read_chunks(), for a file that is already in memory.
+    // Returns the offset of the sample data.
+    size_t wav_file_parse_chunks(wav_info_t& destination, const uint8_t* bytes, size_t size)
+    {
+        if (size < sizeof(riff_hdr_t)) {
+            throw wav_file_parse_exception("File too short for a RIFF header");
+        }
+
+        memcpy(&destination.riff_hdr, bytes, sizeof(riff_hdr_t));
+        riff_check_magic(destination.riff_hdr);
+
+        bool found_fmt = false;
+        size_t offset = sizeof(riff_hdr_t);
+        while (offset + sizeof(chunk_hdr_t) <= size) {
+            chunk_hdr_t hdr;
+            memcpy(&hdr, bytes + offset, sizeof(chunk_hdr_t));
+            offset += sizeof(chunk_hdr_t);
+
+            size_t chunk_size = convert_endianness(hdr.chunk_size);
+            switch (convert_endianness(hdr.chunk_id)) {
+            case FMT_MAGIC:
+                if (chunk_size < FMT_CHUNK_SIZE || offset + FMT_CHUNK_SIZE > size) {
+                    throw wav_file_parse_exception("Unexpected length for FMT chunk (should be at least 16)");
+                }
+
+                found_fmt = true;
+                memcpy(&destination.fmt_chunk, bytes + offset, sizeof(fmt_chunk_t));
+
+                destination.has_fmt_extension = chunk_size >= FMT_EXTENSIBLE_CHUNK_SIZE &&
+                                                offset + FMT_EXTENSIBLE_CHUNK_SIZE <= size;
+                if (destination.has_fmt_extension) {
+                    memcpy(&destination.fmt_extension, bytes + offset + FMT_CHUNK_SIZE, sizeof(fmt_extension_t));
+                }
+                break;
+
+            case DATA_MAGIC:
+                if (!found_fmt) {
+                    throw wav_file_parse_exception("We don't support DATA chunks before FMT chunks");
+                }
+
+                if (chunk_size > size - offset) {
+                    throw wav_file_parse_exception("Data chunk extends past the end of file");
+                }
+
+                destination.data_chunk_hdr = hdr;
+                return offset;
+            }
+
+            // Chunks are padded to an even size
+            offset += chunk_size + (chunk_size & 1);
+        }
+
+        if (!found_fmt) {
+            throw wav_file_parse_exception("FMT chunk not found");
+        }
+
+        throw wav_file_parse_exception("Data chunk not found");
+    }
+
+    // Returns the number of frames in the data chunk, checking that the
+    // data holds whole frames.
+    size_t wav_file_count_frames(const wav_info_t& info, size_t frame_size)
+    {
+        // Get the total number of frames from the data chunk header
+        size_t total_bytes = convert_endianness(info.data_chunk_hdr.chunk_size);
+
+        if (total_bytes % frame_size != 0) {
+            throw wav_file_parse_exception("The total number of bytes in the data is not divisible by the frame size");
+        }
+
+        return total_bytes / frame_size;
+    }
+
+    void wav_file_check_channel(int channel, size_t channels)
+    {
+        if (channel != PCM_DOWNMIX && (channel < 0 || static_cast<size_t>(channel) >= channels)) {
+            throw wav_file_parse_exception("Channel " + to_string(channel) + " is out of range (the file has " +
+                                           to_string(channels) + ")");
+        }
+    }
 }
 
-wav_file::wav_file(std::istream& _file) : file(_file)
+wav_file::wav_file(std::istream& _file, int _channel) : channel(_channel), file(_file)
 {
     union {
         riff_hdr_t hdr;
@@ -162,98 +298,121 @@ wav_file::wav_file(std::istream& _file) : file(_file)
     riff_check_magic(riff.hdr);
 
     wav_file_read_chunks(info, file);
-    wav_file_check_sanity(info);
+    encoding = wav_file_check_sanity(info);
 
     fmt_chunk_t& fmt = info.fmt_chunk;
 
-    bytes_per_sample = convert_endianness(fmt.bits_per_sample) / 8;
     channels = convert_endianness(fmt.num_channels);
+    wav_file_check_channel(channel, channels);
 
-    if (channels > 1) {
-        throw wav_file_parse_exception("We currently do not handle more than 1 channel. Please downmix");
-    }
-
+    frame_size = get_pcm_sample_size(encoding) * channels;
     sample_rate = convert_endianness(fmt.sample_rate);
-
-    // Get the total number of samples from the data chunk header
-    size_t total_bytes = info.data_chunk_hdr.chunk_size;
-
-    if (total_bytes % bytes_per_sample != 0) {
-        throw wav_file_parse_exception("The total number of bytes in the data is not divisible by the bytes per sample");
-    }
-
-    total_samples = total_bytes / bytes_per_sample;
+    total_samples = wav_file_count_frames(info, frame_size);
 
     // At this point, the next data to be read will be raw sample data.
     samples_read = 0;
 }
 
-template<>
-void wav_file::interpret_samples<8>(const vector<uint8_t>& bytes, vector<sample_t>& destination)
+void wav_file::read_samples(std::vector<sample_t>& destination, size_t sample_count)
 {
-    for (uint8_t byte : bytes) {
-        destination.push_back(2.0f * (byte / 255.0f) - 1.0f);
+    if (sample_count > (total_samples - samples_read)) {
+        throw wav_file_parse_exception("The sample count requested is past the end of file");
+    }
+
+    destination.resize(sample_count);
+    if (sample_count > 0) {
+        next_block(destination.data(), sample_count);
     }
 }
 
-template<>
-void wav_file::interpret_samples<16>(const vector<uint8_t>& bytes, vector<sample_t>& destination)
+size_t wav_file::next_block(sample_t* destination, size_t count)
 {
-    for (size_t i = 0; i < bytes.size(); i += 2) {
-        union {
-            int16_t integer;
-            uint8_t bytes[2];
-        } u;
-
-        u.bytes[0] = bytes[i];
-        u.bytes[1] = bytes[i + 1];
-
-        int16_t sample = u.integer;
-        sample_t sample_f;
-
-        if (sample < 0) {
-            sample_f = static_cast<sample_t>(sample) / (1 << 15);
-        } else {
-            sample_f = static_cast<sample_t>(sample) / ((1 << 15) - 1);
-        }
+    count = min(count, total_samples - samples_read);
+
+    size_t byte_count = count * frame_size;
+    if (bytes.size() < byte_count) {
+        bytes.resize(byte_count);
+    }
 
-        destination.push_back(sample_f);
+    file.read(reinterpret_cast<char*>(bytes.data()), byte_count);
+    if (static_cast<size_t>(file.gcount()) != byte_count) {
+        throw wav_file_parse_exception("Unexpected read error / EOF");
     }
+    samples_read += count;
+
+    convert_pcm_frames(bytes.data(), count, encoding, channels, channel, destination);
+    return count;
 }
 
-void wav_file::read_samples(std::vector<sample_t>& destination, size_t sample_count)
+mapped_wav_file::mapped_wav_file(const std::string& filename, int _channel)
+    : mapping(MAP_FAILED), mapping_size(0), samples_read(0), channel(_channel)
 {
-    if (sample_count > (total_samples - samples_read)) {
-        throw wav_file_parse_exception("The sample count requested is past the end of file");
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw wav_file_parse_exception("Cannot open `" + filename + "`: " + strerror(errno));
     }
 
-    vector<uint8_t> bytes;
-    size_t byte_count = sample_count * bytes_per_sample;
-    bytes.resize(byte_count);
-    try {
-        file.read(reinterpret_cast<char*>(&bytes[0]), byte_count);
-        samples_read += sample_count;
-    } catch (exception& e) {
-        throw wav_file_parse_exception("Unexpected read error / EOF");
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int error = errno;
+        close(fd);
+        throw wav_file_parse_exception("Cannot stat `" + filename + "`: " + strerror(error));
     }
 
-    destination.clear();
-    destination.reserve(sample_count);
+    // mmap() refuses empty files, which are not valid WAV files anyway
+    mapping_size = st.st_size;
+    if (mapping_size == 0) {
+        close(fd);
+        throw wav_file_parse_exception("File too short for a RIFF header");
+    }
 
-    if (bytes_per_sample == 1) {
-        interpret_samples<8>(bytes, destination);
-    } else if (bytes_per_sample == 2) {
-        interpret_samples<16>(bytes, destination);
-    } else {
-        throw wav_file_parse_exception("Unsupported sample bit depth");
+    // The mapping stays valid after the descriptor is closed
+    mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw wav_file_parse_exception("Cannot map `" + filename + "`: " + strerror(error));
     }
+
+    // Samples are mostly read front to back
+    madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+
+    try {
+        const uint8_t* bytes = static_cast<const uint8_t*>(mapping);
+        wav_info_t info;
+        size_t data_offset = wav_file_parse_chunks(info, bytes, mapping_size);
+
+        sample_rate = convert_endianness(info.fmt_chunk.sample_rate);
+
+        pcm.data = bytes + data_offset;
+        pcm.encoding = wav_file_check_sanity(info);
+        pcm.channels = convert_endianness(info.fmt_chunk.num_channels);
+        pcm.frame_count = wav_file_count_frames(info, get_pcm_sample_size(pcm.encoding) * pcm.channels);
+        wav_file_check_channel(channel, pcm.channels);
+    } catch (wav_file_parse_exception& e) {
+        munmap(mapping, mapping_size);
+        throw;
+    }
+}
+
+void mapped_wav_file::read_samples(size_t first, size_t count, sample_t* destination) const
+{
+    size_t available = first < pcm.frame_count ? min(count, pcm.frame_count - first) : 0;
+    size_t frame_size = get_pcm_sample_size(pcm.encoding) * pcm.channels;
+    convert_pcm_frames(pcm.data + first * frame_size, available, pcm.encoding, pcm.channels, channel, destination);
+    fill(destination + available, destination + count, 0.0f);
 }
 
-audio_t wordalyzer::audio_from_wav(istream& f)
+size_t mapped_wav_file::next_block(sample_t* destination, size_t count)
 {
-    wav_file w(f);
-    vector<float> samples(w.get_total_samples());
-    w.read_samples(samples, w.get_total_samples());
+    count = min(count, pcm.frame_count - samples_read);
+    read_samples(samples_read, count, destination);
+    samples_read += count;
 
-    return { samples, static_cast<int>(w.get_sample_rate()) };
+    return count;
+}
+
+mapped_wav_file::~mapped_wav_file()
+{
+    munmap(mapping, mapping_size);
 }
@@ -5,7 +5,7 @@
 #include <vector>
 #include <exception>
 
-#include "audio.hpp"
+#include "pcm.hpp"
 
 namespace wordalyzer {
     class wav_file_parse_exception : public std::exception {
@@ -24,11 +24,23 @@ namespace wordalyzer {
         }
     };
 
+    // The PCM data of a WAV file, exactly as it is stored in the file. A
+    // frame holds one sample of each channel.
+    struct pcm_view_t {
+        const std::uint8_t* data;
+        pcm_encoding_t encoding;
+        size_t channels;
+        size_t frame_count;
+    };
+
+    // Both readers return one sample per frame: the channel given to their
+    // constructor, or by default the average of all channels.
+
     class wav_file {
     public:
         typedef float sample_t;
 
-        wav_file(std::istream& _file);
+        wav_file(std::istream& _file, int _channel = PCM_DOWNMIX);
 
         size_t get_total_samples() const {
             return total_samples;
@@ -48,13 +60,66 @@ namespace wordalyzer {
 
         void read_samples(std::vector<sample_t>& destination, size_t sample_count);
 
+        // Reads up to `count` of the next samples to `destination` and
+        // returns how many were read, 0 once all of them have been. Reuses
+        // its buffer, so reading blocks of a fixed size does not allocate
+        // after the first one.
+        size_t next_block(sample_t* destination, size_t count);
+
     private:
-        size_t total_samples, sample_rate, channels, bytes_per_sample, samples_read;
+        size_t total_samples, sample_rate, channels, frame_size, samples_read;
+        pcm_encoding_t encoding;
+        int channel;
         std::istream& file;
-
-        template<size_t BitDepth>
-        void interpret_samples(const std::vector<std::uint8_t>& bytes, std::vector<sample_t>& destination);
+        std::vector<std::uint8_t> bytes;
     };
 
-    audio_t audio_from_wav(std::istream& f);
+    // A WAV file mapped into memory. The chunks are parsed in place and the
+    // samples are only converted to float when they are read, so any part
+    // of the file can be read without going through the rest of it.
+    class mapped_wav_file {
+    public:
+        typedef float sample_t;
+
+        mapped_wav_file(const std::string& filename, int _channel = PCM_DOWNMIX);
+        ~mapped_wav_file();
+
+        mapped_wav_file(const mapped_wav_file&) = delete;
+        mapped_wav_file& operator=(const mapped_wav_file&) = delete;
+
+        size_t get_total_samples() const {
+            return pcm.frame_count;
+        }
+
+        size_t get_sample_rate() const {
+            return sample_rate;
+        }
+
+        size_t get_channels() const {
+            return pcm.channels;
+        }
+
+        size_t get_samples_read() const {
+            return samples_read;
+        }
+
+        const pcm_view_t& get_pcm() const {
+            return pcm;
+        }
+
+        // Converts `count` samples starting at `first` to float. Samples
+        // past the end of the file are read as silence.
+        void read_samples(size_t first, size_t count, sample_t* destination) const;
+
+        // Same as wav_file::next_block(), converting the next samples from
+        // the mapping.
+        size_t next_block(sample_t* destination, size_t count);
+
+    private:
+        void* mapping;
+        size_t mapping_size;
+        size_t sample_rate, samples_read;
+        int channel;
+        pcm_view_t pcm;
+    };
 }
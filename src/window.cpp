@@ -1,5 +1,7 @@
 #include "window.hpp"
 #include <cmath>
+#include <map>
+#include <mutex>
 
 using namespace wordalyzer;
 using namespace std;
@@ -15,6 +17,9 @@ namespace wordalyzer {
 
     template<typename Window>
     void apply_window_fn(vector<float>& samples);
+
+    template<typename Window>
+    void fill_window_table(vector<float>& table, float scale);
 }
 
 template<typename Window>
@@ -27,6 +32,16 @@ void wordalyzer::apply_window_fn(vector<float>& samples)
     }
 }
 
+template<typename Window>
+void wordalyzer::fill_window_table(vector<float>& table, float scale)
+{
+    Window w;
+    for (size_t i = 0; i < table.size(); i++) {
+        float alpha = static_cast<float>(i) / (table.size() - 1);
+        table[i] = w(alpha) * scale;
+    }
+}
+
 const float HAMMING_ALPHA = 0.54f;
 const float HAMMING_BETA = 1.0f - HAMMING_ALPHA;
 
@@ -80,3 +95,41 @@ float wordalyzer::get_window_gain(WindowFunction fn)
     default: return 1.0f;
     }
 }
+
+const vector<float>& wordalyzer::get_window_table(WindowFunction fn, int size)
+{
+    static mutex tables_mutex;
+    static map<pair<WindowFunction, int>, vector<float>> tables;
+
+    lock_guard<mutex> lock(tables_mutex);
+    auto it = tables.find({ fn, size });
+    if (it != tables.end()) {
+        return it->second;
+    }
+
+    vector<float>& table = tables[{ fn, size }];
+    table.resize(size);
+
+    float scale = 1.0f / get_window_gain(fn);
+    switch (fn) {
+    case WINDOW_HAMMING: fill_window_table<hamming_window>(table, scale); break;
+    case WINDOW_HANN: fill_window_table<hann_window>(table, scale); break;
+    case WINDOW_NONE:
+    default:
+        for (float& c : table) {
+            c = scale;
+        }
+        break;
+    }
+
+    return table;
+}
+
+void wordalyzer::apply_window_table(const float* samples, const vector<float>& table, float* destination)
+{
+    const float* coeffs = &table[0];
+    size_t n = table.size();
+    for (size_t i = 0; i < n; i++) {
+        destination[i] = samples[i] * coeffs[i];
+    }
+}
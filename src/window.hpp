@@ -15,4 +15,13 @@ namespace wordalyzer {
     float get_hamming_window_gain();
     float get_hann_window_gain();
     float get_window_gain(WindowFunction fn);
+
+    // Returns the coefficients of a window function of a given size with
+    // the window gain already divided out. Tables are computed once per
+    // (function, size) and cached.
+    const std::vector<float>& get_window_table(WindowFunction fn, int size);
+
+    // Copies table.size() samples to `destination` while applying a window
+    // table, in a single pass.
+    void apply_window_table(const float* samples, const std::vector<float>& table, float* destination);
 }
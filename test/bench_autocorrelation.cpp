@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "autocorrelation.hpp"
+#include "benchmark.hpp"
+
+using namespace wordalyzer;
+using namespace std;
+
+// How analyze_window computed each lag before autocorrelate(): one pass
+// over the frame per lag, converting every sample to double again
+double autocorrelate_per_lag(const vector<float>& samples, int k)
+{
+    double res = 0.0;
+    for (size_t i = k; i < samples.size(); i++) {
+        res += static_cast<double>(samples[i]) * static_cast<double>(samples[i - k]);
+    }
+
+    return res;
+}
+
+vector<float> make_frame(size_t n)
+{
+    mt19937 rng(1);
+    uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    vector<float> frame(n);
+    for (float& sample : frame) {
+        sample = dist(rng);
+    }
+
+    return frame;
+}
+
+// Runs about `work` multiply-adds per timing
+int get_calls(size_t n, int p, double work)
+{
+    return max(static_cast<int>(work / (n * (p + 1))), 1);
+}
+
+void bench_per_lag()
+{
+    printf("Per lag loop against autocorrelate(), microseconds per frame\n");
+    printf("%6s %4s %10s %10s %8s\n", "n", "p", "per lag", "direct", "speedup");
+
+    for (size_t n : { 256, 1024, 4410 }) {
+        vector<float> frame = make_frame(n);
+        for (int p : { 10, 16, 24, 48 }) {
+            vector<double> R(p + 1);
+            autocorrelation_scratch_t scratch;
+            reserve_autocorrelation_scratch(scratch, n, p);
+            int calls = get_calls(n, p, 5e7);
+
+            double per_lag = benchmark::time_call([&] {
+                for (int k = 0; k <= p; k++) {
+                    R[k] = autocorrelate_per_lag(frame, k);
+                }
+            }, calls);
+            double direct = benchmark::time_call([&] {
+                autocorrelate(frame.data(), n, p, R.data(), scratch);
+            }, calls);
+
+            printf("%6zu %4d %10.2f %10.2f %8.2f\n", n, p, per_lag * 1e6, direct * 1e6, per_lag / direct);
+        }
+    }
+}
+
+// Times both methods over a grid of frame sizes and orders, to find the
+// work ratio above which the FFT becomes faster. The thresholds in
+// get_fft_crossover() are this, rounded up, for each instruction set;
+// run with WORDALYZER_SIMD=sse2 or scalar to measure the other kernels.
+void bench_crossover()
+{
+    printf("\nDirect against FFT autocorrelation, microseconds per frame\n");
+    printf("%6s %4s %10s %10s %8s %8s %8s\n", "n", "p", "direct", "fft", "fft/dir", "work", "chosen");
+
+    double direct_until = 0.0, fft_from = numeric_limits<double>::max();
+    for (size_t n : { 256, 512, 1024, 2048, 4410, 8192 }) {
+        vector<float> frame = make_frame(n);
+        for (int p : { 8, 16, 32, 64, 128, 192, 256, 384 }) {
+            vector<double> R(p + 1);
+            autocorrelation_scratch_t scratch;
+            reserve_autocorrelation_scratch(scratch, n, p);
+            int calls = get_calls(n, p, 2e8);
+
+            double direct = benchmark::time_call([&] {
+                autocorrelate(frame.data(), n, p, R.data(), scratch);
+            }, calls);
+            double fft = benchmark::time_call([&] {
+                autocorrelate_fft(frame.data(), n, p, R.data(), scratch);
+            }, calls);
+
+            double work = get_autocorrelation_work_ratio(n, p);
+            if (fft < direct) {
+                fft_from = min(fft_from, work);
+            } else {
+                direct_until = max(direct_until, work);
+            }
+
+            bool chosen_fft = choose_autocorrelation_method(n, p) == AUTOCORRELATION_FFT;
+            printf("%6zu %4d %10.2f %10.2f %8.2f %8.2f %8s\n",
+                   n, p, direct * 1e6, fft * 1e6, fft / direct, work, chosen_fft ? "fft" : "direct");
+        }
+    }
+
+    printf("\nDirect faster up to a work ratio of %.2f, FFT faster from %.2f. Threshold used: %.2f\n",
+           direct_until, fft_from, get_fft_crossover());
+}
+
+int main()
+{
+    bench_per_lag();
+    bench_crossover();
+    return 0;
+}
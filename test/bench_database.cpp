@@ -0,0 +1,145 @@
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+#include "benchmark.hpp"
+#include "database.hpp"
+
+using namespace wordalyzer;
+using namespace std;
+
+const int CLIP_COUNT = 20;
+const int CALLS = 10000;
+const size_t FRAMES = 30;
+const size_t ORDER = 13;
+
+string get_clip_name(int i)
+{
+    return "clip_" + to_string(i);
+}
+
+void fill_database(database& db, int word_count)
+{
+    mt19937 rng(1);
+    uniform_real_distribution<double> dist(-1.0, 1.0);
+
+    for (int i = 0; i < CLIP_COUNT; i++) {
+        clip_t clip;
+        clip.name = get_clip_name(i);
+        clip.vector_size = ORDER;
+        clip.window_size = 1024;
+        clip.window_stride = 512;
+        clip.precision = PRECISION_DOUBLE;
+        clip.sample_rate = 44100;
+
+        for (int w = 0; w < word_count; w++) {
+            word_t word;
+            word.coeffs.resize(FRAMES, ORDER);
+            for (size_t j = 0; j < FRAMES * ORDER; j++) {
+                word.coeffs.data()[j] = dist(rng);
+            }
+            clip.words.push_back(word);
+        }
+
+        db.add_clip(clip);
+    }
+}
+
+// How get_clip() read a clip before statements were cached: both queries
+// are prepared and finalized on every call
+clip_t get_clip_uncached(sqlite3* db, const string& clip_name)
+{
+    clip_t result;
+    result.name = clip_name;
+
+    sqlite3_stmt* clip_statement = nullptr;
+    sqlite3_prepare_v3(db,
+                       "SELECT vector_size, window_size, window_stride, precision, sample_rate FROM clip WHERE name = ?",
+                       -1, 0, &clip_statement, nullptr);
+    sqlite3_bind_text(clip_statement, 1, clip_name.c_str(), clip_name.length(), SQLITE_TRANSIENT);
+    if (sqlite3_step(clip_statement) == SQLITE_ROW) {
+        result.vector_size = sqlite3_column_int(clip_statement, 0);
+        result.window_size = sqlite3_column_int(clip_statement, 1);
+        result.window_stride = sqlite3_column_int(clip_statement, 2);
+        result.precision = static_cast<Precision>(sqlite3_column_int(clip_statement, 3));
+        result.sample_rate = sqlite3_column_int(clip_statement, 4);
+    }
+    sqlite3_finalize(clip_statement);
+
+    sqlite3_stmt* word_statement = nullptr;
+    sqlite3_prepare_v3(db,
+                       "SELECT word_index, vectors_serialized FROM word WHERE clip_name = ? ORDER BY word_index",
+                       -1, 0, &word_statement, nullptr);
+    sqlite3_bind_text(word_statement, 1, clip_name.c_str(), clip_name.length(), SQLITE_TRANSIENT);
+    while (sqlite3_step(word_statement) == SQLITE_ROW) {
+        const byte* data = static_cast<const byte*>(sqlite3_column_blob(word_statement, 1));
+        result.words.push_back(deserialize_word(data, sqlite3_column_bytes(word_statement, 1)));
+    }
+    sqlite3_finalize(word_statement);
+
+    return result;
+}
+
+void remove_database(const string& filename)
+{
+    for (const char* suffix : { "", "-wal", "-shm" }) {
+        remove((filename + suffix).c_str());
+    }
+}
+
+void bench(database& db, const string& filename, int word_count)
+{
+    fill_database(db, word_count);
+
+    sqlite3* raw = nullptr;
+    sqlite3_open_v2(filename.c_str(), &raw, SQLITE_OPEN_READONLY, nullptr);
+
+    size_t frames = 0;
+    double uncached = benchmark::time_call([&] {
+        for (int i = 0; i < CALLS; i++) {
+            frames += get_clip_uncached(raw, get_clip_name(i % CLIP_COUNT)).words.back().get_frames();
+        }
+    }, 1, 3);
+    double cached = benchmark::time_call([&] {
+        for (int i = 0; i < CALLS; i++) {
+            frames += db.get_clip(get_clip_name(i % CLIP_COUNT)).words.back().get_frames();
+        }
+    }, 1, 3);
+    double scanned = benchmark::time_call([&] {
+        for (int i = 0; i < CALLS; i++) {
+            database::word_cursor cursor = db.scan_clip_words(get_clip_name(i % CLIP_COUNT));
+            while (cursor.next()) {
+                frames += cursor.get().get_frames();
+            }
+        }
+    }, 1, 3);
+
+    sqlite3_close(raw);
+
+    printf("%5d %12.1f %12.1f %12.1f\n", word_count, uncached * 1e3, cached * 1e3, scanned * 1e3);
+    if (frames == 0) {
+        printf("No frames read\n");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    string filename = argc > 1 ? argv[1] : "bench_database.db";
+
+    printf("%d clip reads over %d clips, words of %zux%zu coefficients, milliseconds\n",
+           CALLS, CLIP_COUNT, FRAMES, ORDER);
+    printf("%5s %12s %12s %12s\n", "words", "uncached", "get_clip", "cursor");
+
+    for (int word_count : { 1, 4 }) {
+        remove_database(filename);
+        {
+            database db(filename);
+            bench(db, filename, word_count);
+        }
+        remove_database(filename);
+    }
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <list>
+#include <random>
+#include <vector>
+
+#include "allocation_counter.hpp"
+#include "endpointing.hpp"
+
+using namespace wordalyzer;
+using namespace std;
+
+// compute_endpoints() as it was before spans were kept in a vector: every
+// window is classified into a vector<bool> first, then turned into a
+// std::list of spans that the filters erase from.
+namespace before {
+    const int NOISE_SAMPLE_MS = 100;
+    const int WINDOW_SIZE_MS = 10;
+
+    const int PARAM_X = 20;
+    const int PARAM_Y = 20;
+    const int PARAM_Z = 10;
+
+    struct span_t {
+        size_t start, len;
+    };
+
+    float compute_mean(vector<float>::const_iterator start, vector<float>::const_iterator end)
+    {
+        float sample_sum = 0.0f;
+        int sample_n = 0;
+        for (auto it = start; it < end; it++) {
+            sample_sum += abs(*it);
+            sample_n++;
+        }
+
+        return sample_sum / sample_n;
+    }
+
+    float compute_noise_threshold(vector<float>::const_iterator start, vector<float>::const_iterator end)
+    {
+        float mean = compute_mean(start, end);
+        float variance = 0.0f;
+        int sample_n = 0;
+        for (auto it = start; it < end; it++) {
+            float diff = *it - mean;
+            variance += diff * diff;
+            sample_n++;
+        }
+
+        return mean + sqrt(variance / sample_n);
+    }
+
+    list<span_t> to_speech_spans(const vector<bool>& is_speech)
+    {
+        list<span_t> res;
+        if (is_speech.empty()) {
+            return res;
+        }
+
+        bool prev = is_speech[0];
+        size_t start = 0;
+        for (size_t i = 0; i < is_speech.size(); i++) {
+            if (prev != is_speech[i]) {
+                if (prev) {
+                    res.push_back({ start, i - start });
+                }
+                start = i;
+            }
+            prev = is_speech[i];
+        }
+
+        if (prev) {
+            res.push_back({ start, is_speech.size() - start });
+        }
+
+        return res;
+    }
+
+    void raise_peaks(list<span_t>& spans)
+    {
+        if (spans.empty()) {
+            return;
+        }
+
+        auto prev = spans.begin();
+        for (auto it = next(prev); it != spans.end(); prev = it, it++) {
+            int zeros_before = it->start - prev->start - prev->len;
+            if (zeros_before < PARAM_X) {
+                int new_ones = prev->len + zeros_before + it->len;
+                if (new_ones > PARAM_Y) {
+                    prev->len += zeros_before + it->len;
+                    spans.erase(it);
+                    it = prev;
+                }
+            }
+        }
+    }
+
+    void lower_pits(list<span_t>& spans)
+    {
+        for (auto it = spans.begin(); it != spans.end();) {
+            if (it->len < PARAM_Z) {
+                it = spans.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    vector<pair<int, int>> compute_endpoints(const audio_t& audio)
+    {
+        int noise_samples = audio.ms_to_samples(NOISE_SAMPLE_MS);
+        float noise_threshold = compute_noise_threshold(audio.samples.begin(), audio.samples.begin() + noise_samples);
+
+        int window_samples = audio.ms_to_samples(WINDOW_SIZE_MS);
+        vector<bool> is_speech;
+        for (size_t i = noise_samples; i < audio.samples.size() - window_samples; i += window_samples) {
+            float mean = compute_mean(audio.samples.begin() + i, audio.samples.begin() + i + window_samples);
+            is_speech.push_back(mean > noise_threshold);
+        }
+
+        list<span_t> spans = to_speech_spans(is_speech);
+        raise_peaks(spans);
+        lower_pits(spans);
+
+        vector<pair<int, int>> res;
+        for (auto span : spans) {
+            int left_w = span.start, right_w = span.start + span.len;
+            res.push_back({ left_w * window_samples + noise_samples, right_w * window_samples + noise_samples - 1 });
+        }
+
+        return res;
+    }
+}
+
+// Noise with bursts of louder noise for words, from 5 ms to a second long
+audio_t make_audio(int hours)
+{
+    audio_t audio;
+    audio.sample_rate = 8000;
+
+    mt19937 rng(7);
+    normal_distribution<float> noise(0.0f, 0.01f), speech(0.0f, 0.3f);
+    uniform_int_distribution<int> length(40, 8000);
+
+    size_t total = static_cast<size_t>(hours) * 3600 * audio.sample_rate;
+    audio.samples.reserve(total);
+
+    // The first samples must be noise, as they set the threshold
+    bool is_speech = false;
+    int run = audio.ms_to_samples(before::NOISE_SAMPLE_MS);
+    while (audio.samples.size() < total) {
+        for (int i = 0; i < run && audio.samples.size() < total; i++) {
+            audio.samples.push_back(is_speech ? speech(rng) : noise(rng));
+        }
+
+        is_speech = !is_speech;
+        run = length(rng);
+    }
+
+    return audio;
+}
+
+template<typename F>
+void bench(const char* name, F f)
+{
+    // Allocations are those of the calling thread and are only counted in
+    // debug builds, times are only meaningful in release builds
+    size_t allocations = get_thread_allocation_count();
+    auto start = chrono::steady_clock::now();
+    vector<pair<int, int>> words = f();
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+    allocations = get_thread_allocation_count() - allocations;
+
+    printf("%-12s %8zu %10.1f %12zu\n", name, words.size(), elapsed.count(), allocations);
+}
+
+int main()
+{
+    const int HOURS = 2;
+    audio_t audio = make_audio(HOURS);
+
+    printf("Endpointing %d hours of audio at %d Hz\n", HOURS, audio.sample_rate);
+    printf("%-12s %8s %10s %12s\n", "", "words", "ms", "allocations");
+
+    bench("list", [&] { return before::compute_endpoints(audio); });
+    for (int threads : { 1, 2, 4, 8 }) {
+        char name[16];
+        snprintf(name, sizeof(name), "%d thread%s", threads, threads > 1 ? "s" : "");
+        bench(name, [&] { return compute_endpoints(audio, threads); });
+    }
+
+    return 0;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+namespace benchmark {
+    // Seconds per call of `f`, timed over `calls` calls. Returns the best of
+    // `runs` timings, the one least disturbed by the rest of the system.
+    template<typename F>
+    double time_call(F f, int calls, int runs = 5)
+    {
+        double best = std::numeric_limits<double>::max();
+        for (int run = 0; run < runs; run++) {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < calls; i++) {
+                f();
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count() / calls);
+        }
+
+        return best;
+    }
+}
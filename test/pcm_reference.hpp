@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#include "pcm.hpp"
+
+// Sample by sample conversions, as the WAV reader did them before the
+// kernels in pcm.cpp. The kernels must give exactly the same floats.
+namespace reference {
+    inline float convert_sample(const std::uint8_t* sample, wordalyzer::pcm_encoding_t encoding)
+    {
+        switch (encoding) {
+        case wordalyzer::PCM_U8:
+            return 2.0f * (sample[0] / 255.0f) - 1.0f;
+
+        case wordalyzer::PCM_S16: {
+            std::int16_t value;
+            std::memcpy(&value, sample, sizeof(value));
+            return value < 0 ? static_cast<float>(value) / (1 << 15) : static_cast<float>(value) / ((1 << 15) - 1);
+        }
+
+        case wordalyzer::PCM_S24: {
+            std::uint32_t word = (std::uint32_t(sample[0]) << 8) |
+                                 (std::uint32_t(sample[1]) << 16) |
+                                 (std::uint32_t(sample[2]) << 24);
+            std::int32_t value = static_cast<std::int32_t>(word) >> 8;
+            return value < 0 ? static_cast<float>(value) / (1 << 23) : static_cast<float>(value) / ((1 << 23) - 1);
+        }
+
+        case wordalyzer::PCM_S32: {
+            std::int32_t value;
+            std::memcpy(&value, sample, sizeof(value));
+            return static_cast<float>(value < 0 ? value / 2147483648.0 : value / 2147483647.0);
+        }
+
+        case wordalyzer::PCM_F32:
+        default: {
+            float value;
+            std::memcpy(&value, sample, sizeof(value));
+            return value;
+        }
+        }
+    }
+
+    inline void convert_samples(const std::uint8_t* source,
+                                size_t count,
+                                wordalyzer::pcm_encoding_t encoding,
+                                float* destination)
+    {
+        size_t size = wordalyzer::get_pcm_sample_size(encoding);
+        for (size_t i = 0; i < count; i++) {
+            destination[i] = convert_sample(source + i * size, encoding);
+        }
+    }
+
+    // Channels are added in order, then divided by their count
+    inline void downmix_samples(const float* source, size_t frame_count, size_t channels, float* destination)
+    {
+        for (size_t i = 0; i < frame_count; i++) {
+            float sum = source[i * channels];
+            for (size_t c = 1; c < channels; c++) {
+                sum += source[i * channels + c];
+            }
+
+            destination[i] = sum / static_cast<float>(channels);
+        }
+    }
+}
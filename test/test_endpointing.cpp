@@ -0,0 +1,168 @@
+// The checks are asserts, so keep them in release builds as well
+#undef NDEBUG
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "endpointing.hpp"
+#include "wav.hpp"
+
+using namespace wordalyzer;
+using namespace std;
+
+const char* TEST_FILES[] = { "test_endpointing_1.wav", "test_endpointing_2.wav" };
+
+// Inputs are repeated until this many threads get a range of their own
+const int MAX_THREADS = 4;
+
+const int THREAD_COUNTS[] = { 2, 3, 4, 8 };
+
+void write_le(ostream& out, uint32_t value, int size)
+{
+    for (int i = 0; i < size; i++) {
+        out.put(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+// Writes the PCM data of `wav` `repeats` times over to a new WAV file
+void write_repeated_wav(const string& filename, const mapped_wav_file& wav, size_t repeats)
+{
+    const pcm_view_t& pcm = wav.get_pcm();
+    uint32_t block_align = get_pcm_sample_size(pcm.encoding) * pcm.channels;
+    uint32_t data_size = block_align * pcm.frame_count * repeats;
+
+    ofstream out(filename, ios::binary);
+    out.write("RIFF", 4);
+    write_le(out, 36 + data_size, 4);
+    out.write("WAVEfmt ", 8);
+    write_le(out, 16, 4);
+    write_le(out, pcm.encoding == PCM_F32 ? 3 : 1, 2);
+    write_le(out, pcm.channels, 2);
+    write_le(out, wav.get_sample_rate(), 4);
+    write_le(out, wav.get_sample_rate() * block_align, 4);
+    write_le(out, block_align, 2);
+    write_le(out, 8 * get_pcm_sample_size(pcm.encoding), 2);
+    out.write("data", 4);
+    write_le(out, data_size, 4);
+
+    for (size_t i = 0; i < repeats; i++) {
+        out.write(reinterpret_cast<const char*>(pcm.data), block_align * pcm.frame_count);
+    }
+
+    assert(out.good());
+}
+
+void test_file(const string& wav_dir, const string& name, const string& temp_dir)
+{
+    mapped_wav_file wav(wav_dir + "/" + name);
+
+    audio_t once;
+    once.sample_rate = wav.get_sample_rate();
+    once.samples.resize(wav.get_total_samples());
+    wav.read_samples(0, once.samples.size(), once.samples.data());
+
+    // Short inputs stay on one thread whatever the thread count
+    assert(get_endpointing_threads(once.samples.size(), once.sample_rate, MAX_THREADS) == 1);
+    auto once_words = compute_endpoints(once);
+    assert(!once_words.empty());
+    for (int threads : THREAD_COUNTS) {
+        assert(compute_endpoints(once, threads) == once_words);
+    }
+
+    size_t repeats = 1;
+    while (get_endpointing_threads(once.samples.size() * repeats, once.sample_rate, MAX_THREADS) < MAX_THREADS) {
+        repeats++;
+    }
+
+    audio_t repeated;
+    repeated.sample_rate = once.sample_rate;
+    for (size_t i = 0; i < repeats; i++) {
+        repeated.samples.insert(repeated.samples.end(), once.samples.begin(), once.samples.end());
+    }
+
+    auto words = compute_endpoints(repeated, 1);
+    assert(words.size() >= once_words.size() * repeats / 2);
+    for (int threads : THREAD_COUNTS) {
+        assert(compute_endpoints(repeated, threads) == words);
+    }
+
+    // The same input read through a mapping, converted by each thread
+    string repeated_name = temp_dir + "/repeated_" + name;
+    write_repeated_wav(repeated_name, wav, repeats);
+    {
+        mapped_wav_file repeated_wav(repeated_name);
+        assert(compute_endpoints(repeated_wav, 1) == words);
+        for (int threads : THREAD_COUNTS) {
+            assert(compute_endpoints(repeated_wav, threads) == words);
+        }
+    }
+    remove(repeated_name.c_str());
+
+    cout << "[+] " << name << ": " << words.size() << " words in " << repeats << " repeats" << endl;
+}
+
+// Quiet noise with a short word across each boundary between the ranges
+// of 2, 3 and 4 threads. Either half of a word is too short to be kept on
+// its own, so the halves must be joined back together.
+void test_synthetic()
+{
+    audio_t audio;
+    audio.sample_rate = 8000;
+
+    const size_t window_count = 72000;
+    const size_t word_windows = 15;
+    size_t noise_samples = audio.ms_to_samples(100);
+    size_t window_samples = audio.ms_to_samples(10);
+
+    // The last window has to be followed by one more sample
+    mt19937 rng(1);
+    uniform_real_distribution<float> noise(-0.001f, 0.001f);
+    audio.samples.resize(noise_samples + window_count * window_samples + 1);
+    for (float& sample : audio.samples) {
+        sample = noise(rng);
+    }
+
+    vector<size_t> boundaries = { 1, 2, 3 };
+    for (size_t& boundary : boundaries) {
+        boundary = window_count * boundary / 4;
+    }
+    boundaries.push_back(window_count / 3);
+    boundaries.push_back(window_count * 2 / 3);
+
+    for (size_t boundary : boundaries) {
+        size_t first = noise_samples + (boundary - word_windows / 2) * window_samples;
+        for (size_t i = first; i < first + word_windows * window_samples; i++) {
+            audio.samples[i] += 0.5f * sin(0.3f * i);
+        }
+    }
+
+    assert(get_endpointing_threads(audio.samples.size(), audio.sample_rate, MAX_THREADS) == MAX_THREADS);
+    auto words = compute_endpoints(audio, 1);
+    assert(words.size() == boundaries.size());
+    for (int threads : THREAD_COUNTS) {
+        assert(compute_endpoints(audio, threads) == words);
+    }
+
+    cout << "[+] synthetic: " << words.size() << " words across thread boundaries" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3) {
+        cerr << "Usage: " << argv[0] << " <wav directory> <temporary directory>" << endl;
+        return 1;
+    }
+
+    for (const char* name : TEST_FILES) {
+        test_file(argv[1], name, argv[2]);
+    }
+    test_synthetic();
+
+    return 0;
+}
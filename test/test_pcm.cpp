@@ -0,0 +1,193 @@
+// The checks are asserts, so keep them in release builds as well
+#undef NDEBUG
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "pcm.hpp"
+#include "pcm_reference.hpp"
+
+using namespace wordalyzer;
+using namespace std;
+
+const pcm_encoding_t ENCODINGS[] = { PCM_U8, PCM_S16, PCM_S24, PCM_S32, PCM_F32 };
+
+// Long enough for the tails of every kernel and a few whole vectors
+const size_t MAX_SHORT_COUNT = 70;
+
+void store_sample(int64_t value, size_t size, vector<uint8_t>& bytes)
+{
+    for (size_t i = 0; i < size; i++) {
+        bytes.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+// Every value of 8 and 16-bit samples. Wider samples get the ends of their
+// range, the values around zero, and random ones in between.
+vector<uint8_t> make_samples(pcm_encoding_t encoding, mt19937& rng)
+{
+    vector<uint8_t> bytes;
+    size_t size = get_pcm_sample_size(encoding);
+
+    switch (encoding) {
+    case PCM_U8:
+        for (int value = 0; value < 256; value++) {
+            store_sample(value, size, bytes);
+        }
+        break;
+
+    case PCM_S16:
+        for (int value = -32768; value < 32768; value++) {
+            store_sample(value, size, bytes);
+        }
+        break;
+
+    case PCM_S24:
+    case PCM_S32: {
+        int bits = encoding == PCM_S24 ? 24 : 32;
+        int64_t min_value = -(int64_t(1) << (bits - 1));
+        int64_t max_value = (int64_t(1) << (bits - 1)) - 1;
+        for (int64_t value : { min_value, min_value + 1, int64_t(-1), int64_t(0), int64_t(1), max_value - 1, max_value }) {
+            store_sample(value, size, bytes);
+        }
+
+        uniform_int_distribution<int64_t> dist(min_value, max_value);
+        for (int i = 0; i < 100000; i++) {
+            store_sample(dist(rng), size, bytes);
+        }
+        break;
+    }
+
+    case PCM_F32: {
+        vector<float> values = {
+            0.0f, -0.0f, 1.0f, -1.0f,
+            numeric_limits<float>::denorm_min(),
+            numeric_limits<float>::infinity()
+        };
+
+        uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        for (int i = 0; i < 100000; i++) {
+            values.push_back(dist(rng));
+        }
+
+        bytes.resize(values.size() * sizeof(float));
+        memcpy(bytes.data(), values.data(), bytes.size());
+        break;
+    }
+    }
+
+    return bytes;
+}
+
+bool same_floats(const float* a, const float* b, size_t count)
+{
+    return count == 0 || memcmp(a, b, count * sizeof(float)) == 0;
+}
+
+// Converts samples starting at every byte offset and with every short
+// count, from a copy of exactly their size, so that reading past the end
+// shows up under a memory checker
+void test_conversion(pcm_encoding_t encoding, const vector<uint8_t>& bytes)
+{
+    size_t size = get_pcm_sample_size(encoding);
+    size_t count = bytes.size() / size;
+
+    vector<float> expected(count), actual(count);
+    reference::convert_samples(bytes.data(), count, encoding, expected.data());
+    convert_pcm_samples(bytes.data(), count, encoding, actual.data());
+    assert(same_floats(expected.data(), actual.data(), count));
+
+    for (size_t offset = 0; offset < 4; offset++) {
+        for (size_t n = 0; n <= MAX_SHORT_COUNT; n++) {
+            // One byte before the samples puts them at an odd address
+            vector<uint8_t> source(1 + n * size);
+            memcpy(source.data() + 1, bytes.data() + offset * size, n * size);
+
+            // A sentinel after the destination catches writes past its end
+            vector<float> destination(n + 1, 42.0f);
+            convert_pcm_samples(source.data() + 1, n, encoding, destination.data());
+            assert(same_floats(expected.data() + offset, destination.data(), n));
+            assert(destination[n] == 42.0f);
+        }
+    }
+}
+
+void test_downmix(mt19937& rng)
+{
+    uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    for (size_t channels = 1; channels <= 8; channels++) {
+        for (size_t frames : { size_t(0), size_t(1), size_t(7), size_t(8), size_t(9), size_t(31), size_t(1000) }) {
+            vector<float> source(frames * channels);
+            for (float& sample : source) {
+                sample = dist(rng);
+            }
+
+            vector<float> expected(frames), actual(frames + 1, 42.0f);
+            reference::downmix_samples(source.data(), frames, channels, expected.data());
+            downmix_samples(source.data(), frames, channels, actual.data());
+            assert(same_floats(expected.data(), actual.data(), frames));
+            assert(actual[frames] == 42.0f);
+        }
+    }
+}
+
+// Whole frames of several channels, over more than one block of
+// convert_pcm_frames()
+void test_frames(pcm_encoding_t encoding, mt19937& rng)
+{
+    size_t size = get_pcm_sample_size(encoding);
+    uniform_int_distribution<int> byte_dist(0, 255);
+
+    for (size_t channels : { size_t(2), size_t(3), size_t(6) }) {
+        size_t frames = 5001;
+        vector<uint8_t> source(frames * channels * size);
+        for (uint8_t& b : source) {
+            b = byte_dist(rng);
+        }
+
+        // Random bytes make NaNs out of some floats, whose bits the mix
+        // may not keep
+        if (encoding == PCM_F32) {
+            uniform_real_distribution<float> dist(-1.0f, 1.0f);
+            for (size_t i = 0; i < frames * channels; i++) {
+                float value = dist(rng);
+                memcpy(source.data() + i * size, &value, size);
+            }
+        }
+
+        vector<float> samples(frames * channels);
+        reference::convert_samples(source.data(), frames * channels, encoding, samples.data());
+
+        vector<float> expected(frames), actual(frames);
+        reference::downmix_samples(samples.data(), frames, channels, expected.data());
+        convert_pcm_frames(source.data(), frames, encoding, channels, PCM_DOWNMIX, actual.data());
+        assert(same_floats(expected.data(), actual.data(), frames));
+
+        for (size_t channel = 0; channel < channels; channel++) {
+            for (size_t i = 0; i < frames; i++) {
+                expected[i] = samples[i * channels + channel];
+            }
+
+            convert_pcm_frames(source.data(), frames, encoding, channels, channel, actual.data());
+            assert(same_floats(expected.data(), actual.data(), frames));
+        }
+    }
+}
+
+int main()
+{
+    mt19937 rng(1);
+
+    for (pcm_encoding_t encoding : ENCODINGS) {
+        test_conversion(encoding, make_samples(encoding, rng));
+        test_frames(encoding, rng);
+    }
+    test_downmix(rng);
+
+    cout << "[+] PCM conversions match the reference" << endl;
+    return 0;
+}